@@ -0,0 +1,46 @@
+////
+// @file aio.h
+// @brief
+// 异步I/O引擎
+// File在异步模式下把请求交给引擎。Linux下优先使用io_uring，一次io_uring_enter
+// 提交一批请求；内核不支持或被禁止时退回到线程池，由工作线程执行pread/pwrite。
+// 同一个引擎不支持多个线程并发提交/收割。
+//
+// @author junix
+//
+#ifndef __DB_AIO_H__
+#define __DB_AIO_H__
+
+#include "./file.h"
+
+namespace db {
+
+// 引擎接口
+class IoEngine
+{
+  protected:
+    File *file_; // 所属文件
+
+  public:
+    IoEngine(File *file)
+        : file_(file)
+    {}
+    virtual ~IoEngine() {}
+
+    // 引擎类型
+    virtual int type() const = 0;
+    // 一次提交count个请求
+    virtual int submit(IoRequest *reqs, int count) = 0;
+    // 收割完成的请求，至少min个，至多max个
+    virtual int complete(IoRequest **reqs, int max, int min, int &done) = 0;
+    // 放弃还没开始的请求，结果为ECANCELED，等待其余的完成；不会失败，
+    // 返回后内核和工作线程不再访问请求的buffer，可以用complete收割全部请求
+    virtual void quiesce() = 0;
+};
+
+// 创建引擎，type为IO_ENGINE_URING时优先io_uring，不可用时返回线程池
+IoEngine *createIoEngine(File *file, unsigned int depth, int type);
+
+} // namespace db
+
+#endif // __DB_AIO_H__
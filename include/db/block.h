@@ -6,6 +6,11 @@
 // 最小分配单元要比block大得多。
 // block的布局如下，每个slot占用2B，这要求block最大为64KB。由于记录和索引要求按照4B对
 // 齐，BLOCK_DATA、BLOCK_TRAILER也要求4B对齐。
+// block大小按表设定，为4KB到64KB之间的2的幂，记录在root中，缺省为16KB。
+// trailer中checksum的算法同样记录在root中，可选inet风格的32位和，缺省为
+// CRC32C，按大端存放；root自身总是用32位和。
+// root记录文件格式版本，DataBlock头部加入fence之后为1，记录从96B开始；此前的
+// 文件记录从28B开始，版本为0，不再支持打开。
 //
 // +--------------------+
 // |   common header    |
@@ -30,6 +35,7 @@
 #define __DB_BLOCK_H__
 
 #include "./checksum.h"
+#include "./datatype.h"
 #include "./endian.h"
 #include "./timestamp.h"
 
@@ -39,6 +45,7 @@ const short BLOCK_TYPE_DATA = 0;  // 数据
 const short BLOCK_TYPE_INDEX = 1; // 索引
 const short BLOCK_TYPE_META = 2;  // 元数据
 const short BLOCK_TYPE_LOG = 3;   // wal日志
+const short BLOCK_TYPE_FREE = 4;  // 空闲链上的block，只有头部有效
 
 ////
 // @brief
@@ -77,6 +84,23 @@ class Root
         ROOT_GARBAGE_OFFSET + ROOT_GARBAGE_SIZE; // Block数目偏移量
     static const int ROOT_BLOCKCNT_SIZE = 4; // Block数目
 
+    static const int ROOT_ALLOCATED_OFFSET =
+        ROOT_BLOCKCNT_OFFSET + ROOT_BLOCKCNT_SIZE; // 已预分配block数目偏移量
+    static const int ROOT_ALLOCATED_SIZE = 4;      // 已预分配block数目大小
+
+    static const int ROOT_BLOCKSIZE_OFFSET =
+        ROOT_ALLOCATED_OFFSET + ROOT_ALLOCATED_SIZE; // block大小偏移量
+    static const int ROOT_BLOCKSIZE_SIZE = 4;        // block大小
+
+    static const int ROOT_CHECKSUM_OFFSET =
+        ROOT_BLOCKSIZE_OFFSET + ROOT_BLOCKSIZE_SIZE; // checksum算法偏移量
+    static const int ROOT_CHECKSUM_SIZE = 4;         // checksum算法
+
+    static const int ROOT_FORMAT_OFFSET =
+        ROOT_CHECKSUM_OFFSET + ROOT_CHECKSUM_SIZE; // 格式版本偏移量
+    static const int ROOT_FORMAT_SIZE = 4;         // 格式版本大小
+    static const unsigned int FORMAT_VERSION = 1;  // 当前格式，block头部带fence
+
     static const int ROOT_TRAILER_SIZE = 4; // checksum大小
     static const int ROOT_TRAILER_OFFSET =  // checksum偏移量
         ROOT_SIZE - ROOT_TRAILER_SIZE;
@@ -141,6 +165,62 @@ class Root
         return cnt;
     }
 
+    // 设定已预分配的block数目
+    inline void setAllocated(unsigned int cnt)
+    {
+        cnt = htobe32(cnt);
+        ::memcpy(buffer_ + ROOT_ALLOCATED_OFFSET, &cnt, ROOT_ALLOCATED_SIZE);
+    }
+    // 获取已预分配的block数目
+    inline unsigned int getAllocated()
+    {
+        unsigned int cnt;
+        ::memcpy(&cnt, buffer_ + ROOT_ALLOCATED_OFFSET, ROOT_ALLOCATED_SIZE);
+        return be32toh(cnt);
+    }
+
+    // 设定block大小
+    inline void setBlockSize(unsigned int size)
+    {
+        size = htobe32(size);
+        ::memcpy(buffer_ + ROOT_BLOCKSIZE_OFFSET, &size, ROOT_BLOCKSIZE_SIZE);
+    }
+    // 获取block大小
+    inline unsigned int getBlockSize()
+    {
+        unsigned int size;
+        ::memcpy(&size, buffer_ + ROOT_BLOCKSIZE_OFFSET, ROOT_BLOCKSIZE_SIZE);
+        return be32toh(size);
+    }
+
+    // 设定block的checksum算法
+    inline void setChecksumAlgorithm(int algorithm)
+    {
+        algorithm = htobe32(algorithm);
+        ::memcpy(buffer_ + ROOT_CHECKSUM_OFFSET, &algorithm, ROOT_CHECKSUM_SIZE);
+    }
+    // 获取block的checksum算法
+    inline int getChecksumAlgorithm()
+    {
+        int algorithm;
+        ::memcpy(&algorithm, buffer_ + ROOT_CHECKSUM_OFFSET, ROOT_CHECKSUM_SIZE);
+        return be32toh(algorithm);
+    }
+
+    // 设定文件格式版本
+    inline void setFormat(unsigned int version)
+    {
+        version = htobe32(version);
+        ::memcpy(buffer_ + ROOT_FORMAT_OFFSET, &version, ROOT_FORMAT_SIZE);
+    }
+    // 获取文件格式版本，block头部加入fence之前的文件为0
+    inline unsigned int getFormat()
+    {
+        unsigned int version;
+        ::memcpy(&version, buffer_ + ROOT_FORMAT_OFFSET, ROOT_FORMAT_SIZE);
+        return be32toh(version);
+    }
+
     // 获取block链头
     inline unsigned int getHead()
     {
@@ -200,7 +280,9 @@ class Block
 {
   public:
     // 公共头部字段偏移量
-    static const int BLOCK_SIZE = 1024 * 16; // block大小为16KB
+    static const int BLOCK_SIZE = 1024 * 16;     // 缺省block大小为16KB
+    static const int MIN_BLOCK_SIZE = 1024 * 4;  // block最小4KB
+    static const int MAX_BLOCK_SIZE = 1024 * 64; // block最大64KB
 
 #if BYTE_ORDER == LITTLE_ENDIAN
     static const int BLOCK_MAGIC_NUMBER = 0x1ef0c6c1; // magic number
@@ -238,9 +320,7 @@ class Block
         BLOCK_GARBAGE_OFFSET + BLOCK_GARBAGE_SIZE; // 空闲空间偏移量
     static const int BLOCK_FREESPACE_SIZE = 2;     // 空闲空间大小2B
 
-    static const int BLOCK_CHECKSUM_SIZE = 4; // checksum大小4B
-    static const int BLOCK_CHECKSUM_OFFSET =
-        BLOCK_SIZE - BLOCK_CHECKSUM_SIZE; // trailer偏移量
+    static const int BLOCK_CHECKSUM_SIZE = 4; // checksum大小4B，在block末尾
 
     static const short BLOCK_DEFAULT_FREESPACE =
         BLOCK_FREESPACE_OFFSET + BLOCK_FREESPACE_SIZE; // 空闲空间缺省偏移量
@@ -248,17 +328,50 @@ class Block
 
   protected:
     unsigned char *buffer_; // block对应的buffer
+    unsigned int size_;     // block大小
+    int algorithm_;         // checksum算法
 
   public:
     Block()
         : buffer_(NULL)
+        , size_(BLOCK_SIZE)
+        , algorithm_(CHECKSUM_INET)
     {}
-    Block(unsigned char *b)
+    Block(
+        unsigned char *b,
+        unsigned int size = BLOCK_SIZE,
+        int algorithm = CHECKSUM_INET)
         : buffer_(b)
+        , size_(size)
+        , algorithm_(algorithm)
     {}
 
-    // 关联buffer
+    // 关联buffer，大小和checksum算法不变
     inline void attach(unsigned char *buffer) { buffer_ = buffer; }
+    // 关联buffer，设定block大小和checksum算法
+    inline void attach(
+        unsigned char *buffer,
+        unsigned int size,
+        int algorithm = CHECKSUM_INET)
+    {
+        buffer_ = buffer;
+        size_ = size;
+        algorithm_ = algorithm;
+    }
+    // checksum算法
+    inline int algorithm() const { return algorithm_; }
+    // 获取关联的buffer
+    inline unsigned char *buffer() { return buffer_; }
+    // block大小
+    inline unsigned int size() const { return size_; }
+    // trailer偏移量
+    inline unsigned int trailer() const { return size_ - BLOCK_CHECKSUM_SIZE; }
+    // 是否合法的block大小
+    static inline bool validSize(unsigned int size)
+    {
+        return size >= (unsigned int) MIN_BLOCK_SIZE &&
+               size <= (unsigned int) MAX_BLOCK_SIZE && !(size & (size - 1));
+    }
     // 清buffer
     void clear(int spaceid, int blockid);
 
@@ -309,22 +422,28 @@ class Block
     inline void setChecksum()
     {
         unsigned int check = 0;
-        ::memset(buffer_ + BLOCK_CHECKSUM_OFFSET, 0, BLOCK_CHECKSUM_SIZE);
-        check = checksum32(buffer_, BLOCK_SIZE);
-        ::memcpy(buffer_ + BLOCK_CHECKSUM_OFFSET, &check, BLOCK_CHECKSUM_SIZE);
+        if (algorithm_ == CHECKSUM_CRC32C)
+            check = htobe32(crc32c(buffer_, trailer()));
+        else {
+            ::memset(buffer_ + trailer(), 0, BLOCK_CHECKSUM_SIZE);
+            check = checksum32(buffer_, size_);
+        }
+        ::memcpy(buffer_ + trailer(), &check, BLOCK_CHECKSUM_SIZE);
     }
     // 获取checksum
     inline unsigned int getChecksum()
     {
         unsigned int check = 0;
-        ::memcpy(&check, buffer_ + BLOCK_CHECKSUM_OFFSET, BLOCK_CHECKSUM_SIZE);
+        ::memcpy(&check, buffer_ + trailer(), BLOCK_CHECKSUM_SIZE);
         return check;
     }
     // 检验checksum
     inline bool checksum()
     {
+        if (algorithm_ == CHECKSUM_CRC32C)
+            return getChecksum() == htobe32(crc32c(buffer_, trailer()));
         unsigned int sum = 0;
-        sum = checksum32(buffer_, BLOCK_SIZE);
+        sum = checksum32(buffer_, size_);
         return !sum;
     }
 
@@ -374,34 +493,74 @@ class Block
     // 获取freespace大小
     inline unsigned short getFreeLength()
     {
-        unsigned short slots = getSlotsNum();
-        unsigned short offset = getFreespace();
-        unsigned short slots2 = // slots[]起始位置
-            BLOCK_SIZE - slots * sizeof(unsigned short) - BLOCK_CHECKSUM_SIZE;
+        unsigned int slots2 = // slots[]起始位置
+            trailer() - getSlotsNum() * sizeof(unsigned short);
+        unsigned int offset = getFreespace();
         if (offset >= slots2)
             return 0;
         else
-            return BLOCK_SIZE - slots * sizeof(short) - BLOCK_CHECKSUM_SIZE -
-                   offset;
+            return (unsigned short) (slots2 - offset);
     }
 
     // 设置slot存储的偏移量，从下向上开始，0....
     inline void setSlot(unsigned short index, unsigned short off)
     {
-        unsigned short offset = BLOCK_SIZE - BLOCK_CHECKSUM_SIZE -
-                                (index + 1) * sizeof(unsigned short);
+        unsigned int offset = trailer() - (index + 1) * sizeof(unsigned short);
         *((unsigned short *) (buffer_ + offset)) = off;
     }
     // 获取slot存储的偏移量
     inline unsigned short getSlot(unsigned short index)
     {
-        unsigned short offset = BLOCK_SIZE - BLOCK_CHECKSUM_SIZE -
-                                (index + 1) * sizeof(unsigned short);
+        unsigned int offset = trailer() - (index + 1) * sizeof(unsigned short);
         return *((unsigned short *) (buffer_ + offset));
     }
 
-    // 分配记录及slots，返回false表示失败
+    // 分配记录及slots，slot追加在最后，返回false表示失败
     bool allocate(const unsigned char *header, struct iovec *iov, int iovcnt);
+    // 分配记录，slot插在第index个位置，之后的slot后移；优先重用空闲链表，
+    // 空间零碎放不下时先整理
+    bool allocate(
+        const unsigned char *header,
+        struct iovec *iov,
+        int iovcnt,
+        unsigned short index);
+    // 删除第index个slot，之后的slot前移，记录空间不回收
+    void eraseSlot(unsigned short index);
+    // 删除第index个slot，记录空间放入空闲链表，之后分配时重用
+    void deallocate(unsigned short index);
+    // 空闲链表的总长度
+    unsigned short getGarbageLength();
+    // 整理block，记录依次前移，空闲链表中的空间并入freespace
+    void compact();
+
+  protected:
+    // 空闲链表中每块空间开头的4B存放下一块的偏移量和本块长度，0表示链尾
+    inline unsigned short getChunkNext(unsigned short offset)
+    {
+        unsigned short next;
+        ::memcpy(&next, buffer_ + offset, sizeof(next));
+        return be16toh(next);
+    }
+    inline unsigned short getChunkSize(unsigned short offset)
+    {
+        unsigned short size;
+        ::memcpy(&size, buffer_ + offset + sizeof(size), sizeof(size));
+        return be16toh(size);
+    }
+    inline void setChunk(
+        unsigned short offset,
+        unsigned short next,
+        unsigned short size)
+    {
+        next = htobe16(next);
+        size = htobe16(size);
+        ::memcpy(buffer_ + offset, &next, sizeof(next));
+        ::memcpy(buffer_ + offset + sizeof(next), &size, sizeof(size));
+    }
+    // 从空闲链表中按最佳适配取出size字节，多余的留在链表中，没有时返回0
+    unsigned short takeGarbage(unsigned short size);
+    // offset处记录占用的空间
+    unsigned short recordLength(unsigned short offset);
 };
 
 class MetaBlock : public Block
@@ -433,16 +592,32 @@ class MetaBlock : public Block
 };
 
 // 数据block
+// 头部存放block中最小、最大的key（fence），选择block时只比较头部，不解析记录。
+// key超过DATA_FENCE_SIZE时不存放，长度记为DATA_FENCE_OVERFLOW，退回解析记录。
 class DataBlock : public Block
 {
   public:
     static const int DATA_ROWS_OFFSET =
         BLOCK_FREESPACE_OFFSET + BLOCK_FREESPACE_SIZE; // 记录个数偏移量
     static const int DATA_ROWS_SIZE = 4;               // 记录个数大小4B
+
+    static const int DATA_LOWLEN_OFFSET =
+        DATA_ROWS_OFFSET + DATA_ROWS_SIZE; // 最小key长度偏移量
+    static const int DATA_LOWLEN_SIZE = 2; // 最小key长度大小2B，0表示没有
+    static const int DATA_HIGHLEN_OFFSET =
+        DATA_LOWLEN_OFFSET + DATA_LOWLEN_SIZE; // 最大key长度偏移量
+    static const int DATA_HIGHLEN_SIZE = 2;    // 最大key长度大小2B
+    static const int DATA_FENCE_SIZE = 32;     // fence key大小32B
+    static const unsigned short DATA_FENCE_OVERFLOW = 0xffff; // key太长
+    static const int DATA_LOW_OFFSET =
+        DATA_HIGHLEN_OFFSET + DATA_HIGHLEN_SIZE; // 最小key偏移量
+    static const int DATA_HIGH_OFFSET =
+        DATA_LOW_OFFSET + DATA_FENCE_SIZE; // 最大key偏移量
+
     static const short DATA_DEFAULT_FREESPACE =
-        DATA_ROWS_OFFSET + DATA_ROWS_SIZE; // 空闲空间缺省偏移量
+        DATA_HIGH_OFFSET + DATA_FENCE_SIZE; // 空闲空间缺省偏移量
     static const int BLOCK_DATA_START =
-        DATA_ROWS_OFFSET + DATA_ROWS_SIZE; // 记录开始位置
+        DATA_HIGH_OFFSET + DATA_FENCE_SIZE; // 记录开始位置
 
   public:
     void clear(unsigned int blockid);
@@ -459,6 +634,82 @@ class DataBlock : public Block
         count = htobe32(count);
         ::memcpy(buffer_ + DATA_ROWS_OFFSET, &count, DATA_ROWS_SIZE);
     }
+
+    // 设定最小key，field为NULL表示没有
+    inline void setLow(const struct iovec *field)
+    {
+        setFence(DATA_LOWLEN_OFFSET, DATA_LOW_OFFSET, field);
+    }
+    // 设定最大key
+    inline void setHigh(const struct iovec *field)
+    {
+        setFence(DATA_HIGHLEN_OFFSET, DATA_HIGH_OFFSET, field);
+    }
+    // 引用最小key，头部没有存放时解析第0条记录；block为空时返回false
+    inline bool getLow(unsigned int key, struct iovec &field)
+    {
+        if (getFence(DATA_LOWLEN_OFFSET, DATA_LOW_OFFSET, field)) return true;
+        return getSlotsNum() && getKey(0, key, field);
+    }
+    // 引用最大key，头部没有存放时解析最后一条记录
+    inline bool getHigh(unsigned int key, struct iovec &field)
+    {
+        if (getFence(DATA_HIGHLEN_OFFSET, DATA_HIGH_OFFSET, field)) return true;
+        unsigned short slots = getSlotsNum();
+        return slots && getKey(slots - 1, key, field);
+    }
+    // 按记录重新设定fence，批量搬移记录之后调用
+    void resetFence(unsigned int key);
+
+    // 引用第index个slot所指记录的第key个字段
+    bool getKey(unsigned short index, unsigned int key, struct iovec &field);
+    // 按第key个字段有序插入记录，二分查找插入位置，返回false表示放不下；
+    // 插在两端时更新fence
+    bool insert(
+        unsigned int key,
+        DataType *type,
+        const unsigned char *header,
+        struct iovec *iov,
+        int iovcnt);
+    // 空block能否放下这条记录，放不下时分裂也没有用
+    bool fits(const struct iovec *iov, int iovcnt);
+    // 删除第index条记录，删除两端的记录时更新fence
+    void remove(unsigned int key, unsigned short index);
+    // slots[]按第key个字段有序，二分查找keyField，返回第一个不小于它的slot，
+    // 即插入位置，都小于时返回slots数目；found表示是否找到相等的
+    unsigned short search(
+        unsigned int key,
+        DataType *type,
+        const struct iovec &keyField,
+        bool &found);
+
+  private:
+    // 写fence，太长时只记长度
+    inline void setFence(int lenOffset, int offset, const struct iovec *field)
+    {
+        unsigned short len = 0;
+        if (field) {
+            if (field->iov_len > (size_t) DATA_FENCE_SIZE)
+                len = DATA_FENCE_OVERFLOW;
+            else {
+                len = (unsigned short) field->iov_len;
+                ::memcpy(buffer_ + offset, field->iov_base, len);
+            }
+        }
+        len = htobe16(len);
+        ::memcpy(buffer_ + lenOffset, &len, sizeof(len));
+    }
+    // 引用fence，没有或太长时返回false
+    inline bool getFence(int lenOffset, int offset, struct iovec &field)
+    {
+        unsigned short len;
+        ::memcpy(&len, buffer_ + lenOffset, sizeof(len));
+        len = be16toh(len);
+        if (len == 0 || len == DATA_FENCE_OVERFLOW) return false;
+        field.iov_base = buffer_ + offset;
+        field.iov_len = len;
+        return true;
+    }
 };
 
 } // namespace db
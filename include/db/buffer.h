@@ -0,0 +1,412 @@
+////
+// @file buffer.h
+// @brief
+// 缓冲池
+// 进程内所有文件共享一个缓冲池，以(文件, blockid)为键缓存block，blockid为0表示
+// root。使用者pin得到页面，用完unpin；pin住的页面不会被换出。修改后markDirty，
+// flush写回；未pin的页面按替换策略换出，脏页换出前先写回。页面数不超过容量。
+// 页表和替换队列按键的hash分成若干分区，各分区一把锁，读入、写回都在锁外进行。
+// 页面内容由页面自己的读写latch保护，只能在pin住期间持有；修改页面要持有写latch，
+// 改完之后markDirty。
+// 脏页留在内存中，由后台写回线程在脏页比例超过阈值时写回，相邻的block合并为一次
+// writev；脏页超过上限时修改者在throttle中等待。检查点写回文件的全部脏页并刷盘，
+// 再在root中记下时戳。
+// 缓冲池中某个文件的block列表可以保存下来，重新打开时一次读入，预热缓冲池。
+// 页面内容可以从一整块按2MB大页分配的区域中切出，减少随机访问时的TLB缺失。
+// 页面按文件的block大小读写，至少为缺省block大小，更大的block单独分配。
+// 容量可以在运行中调整；缩小时分批换出干净页面并释放内存，脏页在锁外写回后再
+// 释放，pin住的页面等unpin时释放。
+//
+// @author junix
+//
+#ifndef __DB_BUFFER_H__
+#define __DB_BUFFER_H__
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include "./file.h"
+
+namespace db {
+
+const int PIN_NEW = 0x1;  // 新block，不从文件读，由调用者填写
+const int PIN_ONCE = 0x2; // 只用一次，如全表扫描，不提升页面
+const int PIN_NOVERIFY = 0x4; // 读入时不检验checksum，如空闲链上打过洞的block
+const int PIN_FILL = 0x8; // 不在缓冲中时由调用者读入，填好之前其它pin等待
+
+const int REPLACE_LRU = 0;   // LRU
+const int REPLACE_CLOCK = 1; // CLOCK
+const int REPLACE_2Q = 2;    // 2Q，抗扫描
+
+// 读入block时检验checksum的策略，只检验设定了算法的文件，root不检验；
+// 缓冲中的页面命中时都不再检验
+const int VERIFY_OFF = 0;     // 不检验
+const int VERIFY_ALWAYS = 1;  // 每次从文件读入都检验
+const int VERIFY_FIRST = 2;   // 每个block驻留期间只检验一次，换出后再读入重新检验
+const int VERIFY_SAMPLED = 3; // 每sample次读入检验一次
+
+class Replacer;
+
+// 读写latch，持有时间很短，自旋等待
+class Latch
+{
+  private:
+    std::atomic<int> state_; // 大于0为读者数，-1表示有写者
+
+  public:
+    Latch()
+        : state_(0)
+    {}
+
+    // 加读latch
+    inline void lockShared()
+    {
+        for (;;) {
+            int state = state_.load(std::memory_order_relaxed);
+            if (state >= 0 &&
+                state_.compare_exchange_weak(
+                    state, state + 1, std::memory_order_acquire))
+                return;
+            std::this_thread::yield();
+        }
+    }
+    // 尝试加读latch，有写者时返回false
+    inline bool tryLockShared()
+    {
+        int state = state_.load(std::memory_order_relaxed);
+        while (state >= 0)
+            if (state_.compare_exchange_weak(
+                    state, state + 1, std::memory_order_acquire))
+                return true;
+        return false;
+    }
+    // 释放读latch
+    inline void unlockShared()
+    {
+        state_.fetch_sub(1, std::memory_order_release);
+    }
+    // 加写latch
+    inline void lock()
+    {
+        for (;;) {
+            int state = 0;
+            if (state_.compare_exchange_weak(
+                    state, -1, std::memory_order_acquire))
+                return;
+            std::this_thread::yield();
+        }
+    }
+    // 释放写latch
+    inline void unlock() { state_.store(0, std::memory_order_release); }
+};
+
+// 缓冲页面
+struct Frame
+{
+    File *file;                // 所属文件
+    unsigned long long fileid; // 文件打开序号
+    unsigned int blockid;      // blockid，0表示root
+    unsigned int shard;        // 所在分区
+    unsigned char *data;       // 页面内容，按IO_ALIGNMENT对齐
+    size_t size;               // data的长度，不小于所在文件的block大小
+    unsigned int pins;         // pin计数，受分区锁保护
+    std::atomic<bool> dirty;   // 是否修改未写回
+    std::atomic<bool> loading; // 是否正在读入，读入者持有写latch
+    int error;                 // 读入失败的错误码
+    Latch latch;               // 保护页面内容
+    std::list<Frame *>::iterator hook; // 在替换器队列中的位置
+    int queue;                         // 所在队列，由替换器使用
+    bool ref;                          // 访问位，由替换器使用
+
+    Frame()
+        : file(NULL)
+        , fileid(0)
+        , blockid(0)
+        , shard(0)
+        , data(NULL)
+        , size(0)
+        , pins(0)
+        , dirty(false)
+        , loading(false)
+        , error(S_OK)
+        , queue(0)
+        , ref(false)
+    {}
+};
+
+// 缓冲池统计
+struct BufferStats
+{
+    unsigned long long hits;      // 命中次数
+    unsigned long long misses;    // 未命中次数
+    unsigned long long evictions; // 换出次数
+    unsigned long long writes;    // 写回次数
+    unsigned long long throttles; // 修改者因脏页过多等待的次数
+    unsigned long long checkpoints; // 检查点次数
+    unsigned long long verifies;    // 读入时检验checksum的次数
+    unsigned long long corruptions; // checksum检验失败的次数
+
+    BufferStats()
+        : hits(0)
+        , misses(0)
+        , evictions(0)
+        , writes(0)
+        , throttles(0)
+        , checkpoints(0)
+        , verifies(0)
+        , corruptions(0)
+    {}
+};
+
+class BufferPool
+{
+  public:
+    static const size_t DEFAULT_CAPACITY = 1024; // 缺省1024个页面，16MB
+    static const unsigned int MAX_SHARDS = 16;   // 自动分区时的分区数上限
+    static const size_t SHARD_FRAMES = 64; // 自动分区时每个分区至少的页面数
+    static const unsigned int DEFAULT_WRITER_INTERVAL = 100; // 写回线程周期100ms
+    static const unsigned int DEFAULT_CHECKPOINT_INTERVAL = 10000; // 检查点10s
+    static const unsigned int DEFAULT_DIRTY_BACKGROUND = 10; // 脏页10%开始写回
+    static const unsigned int DEFAULT_DIRTY_LIMIT = 40; // 脏页40%时修改者等待
+    static const size_t MAX_WRITE_RUN = 64; // 一次合并写、批量写的block数上限
+    static const unsigned int WARM_MAGIC_NUMBER = 0x686f7462; // 预热列表magic
+    static const size_t WARM_HEADER_SIZE = 16; // 预热列表头部：magic、个数、checksum
+    static const size_t SHRINK_BATCH = 32; // 缩容时每次持锁释放的页面数上限
+    static const unsigned int DEFAULT_VERIFY_SAMPLE = 16; // 抽样时每16次检验一次
+
+  private:
+    // 页表的键
+    struct Key
+    {
+        unsigned long long fileid;
+        unsigned int blockid;
+
+        bool operator==(const Key &o) const
+        {
+            return fileid == o.fileid && blockid == o.blockid;
+        }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &k) const
+        {
+            unsigned long long h =
+                (k.fileid * 0x9e3779b97f4a7c15ULL) ^ k.blockid;
+            return (size_t) (h * 0xff51afd7ed558ccdULL >> 32);
+        }
+    };
+    typedef std::unordered_map<Key, Frame *, KeyHash> PageTable;
+    typedef std::unordered_set<Key, KeyHash> KeySet;
+
+    // 分区
+    struct Shard
+    {
+        std::mutex mutex;         // 保护以下所有成员
+        size_t capacity;          // 页面数上限
+        size_t count;             // 已分配页面数
+        PageTable table;          // 页表
+        Replacer *replacer;       // 替换策略
+        std::list<Frame *> free;  // 空闲页面
+        BufferStats stats;        // 统计
+        unsigned char *arena;     // 本分区在大块区域中的一段，NULL表示没有
+        size_t slots;             // 这一段可容纳的页面数
+        size_t used;              // 这一段中用过的页面数
+        std::vector<unsigned char *> spare; // 区域中释放后可重用的位置
+        KeySet verified;          // VERIFY_FIRST下已检验过的驻留block
+        unsigned long long loads; // VERIFY_SAMPLED下的读入计数
+
+        Shard()
+            : capacity(0)
+            , count(0)
+            , replacer(NULL)
+            , arena(NULL)
+            , slots(0)
+            , used(0)
+            , loads(0)
+        {}
+    };
+
+  private:
+    std::vector<Shard *> shards_;         // 分区
+    std::atomic<size_t> capacity_;        // 页面数上限
+    std::atomic<size_t> dirty_;           // 脏页数
+    std::atomic<unsigned int> background_; // 后台写回的脏页比例
+    std::atomic<unsigned int> limit_;      // 修改者等待的脏页比例
+    std::atomic<unsigned long long> throttles_;   // 等待次数
+    std::atomic<unsigned long long> checkpoints_; // 检查点次数
+    std::atomic<int> verify_;                     // checksum检验策略
+    std::atomic<unsigned int> sample_;            // 抽样间隔
+    std::atomic<unsigned long long> verifies_;    // 检验次数
+    std::atomic<unsigned long long> corruptions_; // 检验失败次数
+    std::mutex cleanLock_;       // 串行化批量写回、检查点和drop
+    std::thread writer_;         // 后台写回线程
+    std::mutex writerLock_;      // 保护以下写回线程状态
+    std::condition_variable wake_; // 唤醒写回线程
+    std::condition_variable done_; // 写回线程完成一轮
+    bool running_;               // 写回线程是否在运行
+    bool stop_;                  // 写回线程退出标志
+    unsigned int interval_;      // 写回周期，毫秒
+    unsigned int checkpoint_;    // 检查点周期，毫秒，0表示不做
+    int writerError_;            // 最近一轮写回的错误码
+    unsigned char *arena_;       // 页面内容的大块区域，NULL表示逐个分配
+    size_t arenaSize_;           // 区域长度
+    int arenaPages_;             // 区域实际使用的页，PAGES_*
+
+  public:
+    // shards为0时按容量自动决定分区数，容量小时只有一个分区
+    BufferPool(
+        size_t capacity = DEFAULT_CAPACITY,
+        int policy = REPLACE_LRU,
+        unsigned int shards = 0);
+    ~BufferPool();
+
+    // pin住file的第blockid个block，不在缓冲中时读入；PIN_NEW时不读，内容为0；
+    // 读入后checksum检验失败返回EIO。PIN_FILL时不读，页面保持读入中并持有
+    // 写latch，由调用者填写后调用filled；已在缓冲中时照常pin住，返回S_FALSE
+    int pin(File *file, unsigned int blockid, Frame *&frame, int flags = 0);
+    // 在缓冲中则pin住返回，否则返回NULL
+    Frame *lookup(File *file, unsigned int blockid, int flags = 0);
+    // 解除pin
+    void unpin(Frame *frame);
+    // 标记页面已修改
+    void markDirty(Frame *frame);
+    // 写回页面，调用者已pin住
+    int flush(Frame *frame);
+    // 写回file的所有脏页
+    int flush(File *file);
+    // 写回并丢弃file的所有未pin页面，关闭文件前调用
+    int drop(File *file);
+    // 是否在缓冲中，不pin
+    bool cached(File *file, unsigned int blockid);
+    // file在缓冲中的blockid，按blockid排序
+    void resident(File *file, std::vector<unsigned int> &blocks);
+    // 读入blocks，异步模式下一次提交并行完成，否则相邻的合并为readv，不改变
+    // 文件的I/O模式；已缓存的跳过，只用空闲页面，不换出，count返回读入的个数
+    int warm(
+        File *file,
+        const std::vector<unsigned int> &blocks,
+        size_t *count = NULL);
+    // 把file在缓冲中的blockid列表保存到path，覆盖旧列表
+    int dump(File *file, const char *path);
+    // 读入path中保存的列表并预热，列表不存在或损坏时返回S_FALSE
+    int restore(File *file, const char *path, size_t *count = NULL);
+
+    // 启动后台写回线程，每interval毫秒醒来一次，脏页超过后台比例时写回；
+    // 每checkpoint毫秒对有脏页的文件做一次检查点，0表示不做
+    int startWriter(
+        unsigned int interval = DEFAULT_WRITER_INTERVAL,
+        unsigned int checkpoint = DEFAULT_CHECKPOINT_INTERVAL);
+    // 停止后台写回线程
+    void stopWriter();
+    // 后台写回线程是否在运行
+    bool writerRunning();
+    // 设定读入时的checksum检验策略，VERIFY_SAMPLED时每sample次读入检验一次
+    int setVerify(int policy, unsigned int sample = DEFAULT_VERIFY_SAMPLE);
+    // checksum检验策略
+    inline int verifyPolicy() const { return verify_.load(); }
+    // PIN_FILL的页面由调用者从别处读入后调用，如预读帧拷贝进来的block；ret、
+    // bytes为读的结果，按策略检验后结束读入，等待的pin此时才看到页面；
+    // 失败时返回错误码，页面在unpin时丢弃
+    int filled(Frame *frame, int ret, size_t bytes, int flags = 0);
+    // 设定脏页比例（百分比），超过background时后台写回，超过limit时修改者等待
+    int setDirtyRatio(unsigned int background, unsigned int limit);
+    // 脏页数
+    inline size_t dirty() const { return dirty_.load(); }
+    // 脏页超过上限时等待写回，没有写回线程时由调用者写回，调用时不能持有latch
+    int throttle();
+    // 检查点，写回file的全部脏页并刷盘，有写回时在root中记下时戳
+    int checkpoint(File *file);
+    // 对所有有脏页的文件做检查点
+    int checkpoint();
+
+    // 按当前容量一次分配页面内容的区域，huge时优先用2MB大页，不可用时退回
+    // 普通页；必须在分配任何页面之前调用，否则返回EBUSY
+    int setArena(bool huge);
+    // 区域实际使用的页，PAGES_*，没有区域时返回-1
+    int arena();
+
+    // 设定容量，可在运行中调用；缩小时逐个分区分批释放多出的页面，脏页先在
+    // 锁外写回，pin住的页面在unpin时释放；返回写回时遇到的错误
+    int setCapacity(size_t capacity);
+    // 切换替换策略，已缓存的页面按原顺序重新加入
+    void setPolicy(int policy);
+    // 替换策略
+    int policy();
+    // 容量
+    size_t capacity();
+    // 分区数
+    inline unsigned int shards() const { return (unsigned int) shards_.size(); }
+    // 已分配页面数
+    size_t size();
+    // 统计
+    BufferStats stats();
+
+  private:
+    // 键所在的分区
+    inline unsigned int shardOf(const Key &key) const
+    {
+        return (unsigned int) (KeyHash()(key) % shards_.size());
+    }
+    // 持锁调用，取一个至少length字节的可用页面，必要时换出；换出脏页时放锁
+    // 在锁外写回，返回时重新持锁，调用者须重新检查页表
+    int grab(
+        Shard &shard,
+        std::unique_lock<std::mutex> &lock,
+        Frame *&frame,
+        size_t length);
+    // 页面内容是否在区域中
+    inline bool inArena(const unsigned char *data) const
+    {
+        return arena_ != NULL && data >= arena_ && data < arena_ + arenaSize_;
+    }
+    // 持锁调用，释放未pin的干净页面及其内存，页面已从页表和替换器中移除
+    void release(Shard &shard, Frame *frame);
+    // 缩小分区直到不超过容量，每次持锁至多释放SHRINK_BATCH个页面
+    int shrink(Shard &shard);
+    // 持锁调用，释放读入失败的页面
+    void discard(Shard &shard, Frame *frame);
+    // 持锁调用，把页面登记为file的第blockid个block，持有写latch，处于读入状态
+    void assign(
+        Shard &shard,
+        unsigned int index,
+        File *file,
+        unsigned int blockid,
+        Frame *frame,
+        int flags);
+    // 持锁调用，按检验策略决定这次读入是否检验checksum
+    bool verifying(Shard &shard, File *file, unsigned int blockid, int flags);
+    // 检验页面的checksum，失败时计数并从已检验集合中去掉，返回EIO
+    int verify(Frame *frame);
+    // 读入完成，文件尾之后填0，需要时检验checksum，放掉写latch
+    void loaded(Frame *frame, int ret, size_t bytes, bool check = false);
+    // 写页面
+    int write(Frame *frame);
+    // 持cleanLock_调用，写回脏页直到不超过target个，file非NULL时只写该文件；
+    // 按(文件, blockid)排序，相邻的block合并写，异步模式的文件一批提交，
+    // written返回写回的页面数
+    int clean(size_t target, File *file, size_t *written);
+    // 持cleanLock_调用，对file做检查点
+    int sync(File *file);
+    // 比例对应的页面数
+    inline size_t ratioOf(unsigned int ratio) const
+    {
+        return capacity_.load() * ratio / 100;
+    }
+    // 写回线程
+    void run();
+};
+
+// 全局唯一缓冲池
+extern BufferPool &gbuffer;
+
+// file的block大小，未设定时为缺省大小
+unsigned int blockSizeOf(const File *file);
+
+} // namespace db
+
+#endif // __DB_BUFFER_H__
@@ -3,6 +3,8 @@
 // @brief
 // inet校验和
 // 按照网络字节序输出unsigned short校验和
+// 32位和按CPU选择AVX2/SSE2实现，与逐字节累加的结果完全相同
+// CRC32C（Castagnoli多项式），有SSE4.2时用crc32指令，否则按slicing-by-8查表
 //
 // @author niexw
 // @email niexiaowen@uestc.edu.cn
@@ -10,10 +12,20 @@
 #ifndef __DB_CHECKSUM_H__
 #define __DB_CHECKSUM_H__
 
+#include <stddef.h>
 #include "./endian.h"
 
 namespace db {
 
+// 向量指令集
+const int SIMD_SCALAR = 0; // 不用向量指令
+const int SIMD_SSE2 = 1;   // SSE2，每次16B
+const int SIMD_AVX2 = 2;   // AVX2，每次32B
+
+// block的checksum算法，记录在root中
+const int CHECKSUM_INET = 0;   // inet风格的32位和
+const int CHECKSUM_CRC32C = 1; // CRC32C
+
 // 网络字节序checksum
 inline unsigned short checksum(const unsigned char *buf, int len)
 {
@@ -26,7 +38,8 @@ inline unsigned short checksum(const unsigned char *buf, int len)
     if (len) { sum += (*buf) << 8; }
     return htons((unsigned short) (~sum) + 1);
 }
-inline unsigned int checksum32(const unsigned char *buf, int len)
+// 32位和的逐字节实现，大端32位字累加，不足4B的尾部补0
+inline unsigned int checksum32Scalar(const unsigned char *buf, int len)
 {
     unsigned long long sum = 0;
 
@@ -45,6 +58,20 @@ inline unsigned int checksum32(const unsigned char *buf, int len)
 
     return htonl(static_cast<unsigned int>(~sum) + 1);
 }
+// 32位和，只有低32位参与结果，按32位向量累加与checksum32Scalar相同
+unsigned int checksum32(const unsigned char *buf, int len);
+// 按simd指定的指令集计算32位和，CPU不支持时退回标量实现，测试用
+unsigned int checksum32With(int simd, const unsigned char *buf, int len);
+// checksum32使用的指令集
+int checksum32Simd();
+
+// CRC32C，crc为前一段的结果，可以分段计算
+unsigned int crc32c(const unsigned char *buf, size_t len, unsigned int crc = 0);
+// CRC32C的软件实现，结果与crc32c相同
+unsigned int
+crc32cSoftware(const unsigned char *buf, size_t len, unsigned int crc = 0);
+// crc32c是否使用硬件指令
+bool crc32cHardware();
 
 } // namespace db
 
@@ -0,0 +1,72 @@
+////
+// @file commit.h
+// @brief
+// 提交与刷盘
+// 每次提交都fdatasync代价太高。组提交时，第一个到达的提交者成为leader，等待一个
+// 时间窗口或凑够一定个数的提交后执行一次fdatasync，同组的其它提交者等待其完成。
+// leader关闭本组后立即开放下一组，刷盘期间到达的提交者进入下一组。
+// 每组按组号记下自己的刷盘结果，同组的提交者都取走后删除。
+//
+// @author junix
+//
+#ifndef __DB_COMMIT_H__
+#define __DB_COMMIT_H__
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include "./file.h"
+
+namespace db {
+
+class Committer
+{
+  private:
+    // 等待刷盘的一组
+    struct Generation
+    {
+        unsigned int waiters; // 等待结果的跟随者数
+        bool done;            // 刷盘已完成
+        int result;           // 刷盘结果
+
+        Generation()
+            : waiters(0)
+            , done(false)
+            , result(S_OK)
+        {}
+    };
+
+    File *file_;          // 所属文件
+    int level_;           // 持久性
+    unsigned int window_; // 组提交窗口，微秒
+    unsigned int count_;  // 组提交个数上限
+
+    std::mutex mutex_;
+    std::condition_variable full_; // 本组已满，唤醒leader
+    std::condition_variable done_; // 刷盘完成，唤醒同组提交者
+    bool leader_;                  // 当前组是否已有leader
+    unsigned int pending_;         // 当前组的提交数
+    unsigned long long group_;     // 当前组号
+    std::map<unsigned long long, Generation> waiting_; // 有跟随者等待的组
+    SyncStats stats_;                                  // 统计
+
+  public:
+    Committer(File *file, int level, unsigned int window, unsigned int count)
+        : file_(file)
+        , level_(level)
+        , window_(window)
+        , count_(count ? count : 1)
+        , leader_(false)
+        , pending_(0)
+        , group_(1)
+    {}
+
+    // 提交
+    int commit();
+    // 统计
+    SyncStats stats();
+};
+
+} // namespace db
+
+#endif // __DB_COMMIT_H__
@@ -34,8 +34,17 @@ struct iovec
 };
 
 #else
+/* Windows.h隐式提供的基础设施，POSIX下显式引入 */
+#    include <errno.h>
+#    include <stdlib.h>
+#    include <string.h>
+#    include <sys/uio.h>
+#    include <arpa/inet.h>
 #    define S_OK 0    /* 正常返回 */
 #    define S_FALSE 1 /* 异常返回 */
+/* 文件句柄，POSIX下为文件描述符 */
+typedef int HANDLE;
+#    define INVALID_HANDLE_VALUE (-1)
 #    define OCF_WEAK __attribute__((weak))
 /* 禁止符号从dll导出 */
 #    define DLL_NO_EXPORT __attribute__((visibility("hidden")))
@@ -2,6 +2,14 @@
 // @file file.h
 // @brief
 // 文件操作
+// Windows下采用CreateFile/ReadFile/WriteFile，POSIX下采用pread/pwrite。
+// 读写均按偏移量定位，不依赖共享的文件指针，多个读者可以并发访问同一文件。
+// readv/writev把物理相邻的多个block合并为一次系统调用。
+// 只读映射模式下，扫描可以直接访问映射的页面，省去拷贝和系统调用。
+// direct模式绕过页缓存，buffer必须由alignedAlloc分配，偏移量和长度按4KB对齐。
+// 打开异步模式后，可以把多个block的读写请求一次提交，再分批收割完成结果。
+// 持久性分为不刷盘、每次刷盘和组提交三档，组提交时并发的提交者共享一次刷盘。
+// 内存模式下读写落在进程内的内存段上，用于临时表和排除文件系统影响的测量。
 //
 // @author niexw
 // @email niexiaowen@uestc.edu.cn
@@ -12,29 +20,197 @@
 #include "./config.h"
 namespace db {
 
+const int IO_READ = 0;  // 读请求
+const int IO_WRITE = 1; // 写请求
+
+const int IO_ENGINE_URING = 0;   // io_uring引擎
+const int IO_ENGINE_THREADS = 1; // 线程池引擎
+
+const int OPEN_DIRECT = 0x1;   // 绕过页缓存，要求buffer、偏移量、长度对齐
+const int OPEN_MEMORY = 0x2;   // 打开进程内的内存段，不经过文件系统
+const int OPEN_NOCREATE = 0x4; // 只打开已有文件，不存在时返回ENOENT
+const int OPEN_TRUNCATE = 0x8; // 打开时把文件截断为0
+
+const int DURABILITY_NONE = 0;  // 不刷盘，由系统回写
+const int DURABILITY_SYNC = 1;  // 每次提交都刷盘
+const int DURABILITY_GROUP = 2; // 组提交，一个窗口内的提交共享一次刷盘
+
+const int MAP_ADVICE_NORMAL = 0;     // 缺省访问模式
+const int MAP_ADVICE_SEQUENTIAL = 1; // 顺序扫描，积极预读
+const int MAP_ADVICE_RANDOM = 2;     // 随机访问，关闭预读
+const int MAP_ADVICE_WILLNEED = 3;   // 马上要用，提前读入
+
+const int PAGES_NORMAL = 0;  // 普通页
+const int PAGES_THP = 1;     // 透明大页，madvise请求
+const int PAGES_HUGETLB = 2; // 预留的2MB大页，MAP_HUGETLB
+
+// 异步I/O请求
+struct IoRequest
+{
+    int opcode;                // IO_READ/IO_WRITE
+    unsigned long long offset; // 文件偏移量
+    char *buffer;              // 读写buffer
+    size_t length;             // 请求长度
+    size_t bytes;              // 实际完成长度，读到文件尾时小于length
+    int result;                // 完成状态，S_OK或错误码
+    void *data;                // 调用者私有数据
+
+    IoRequest()
+        : opcode(IO_READ)
+        , offset(0)
+        , buffer(NULL)
+        , length(0)
+        , bytes(0)
+        , result(S_OK)
+        , data(NULL)
+    {}
+};
+
+// 刷盘统计
+struct SyncStats
+{
+    unsigned long long commits; // 提交次数
+    unsigned long long flushes; // 刷盘次数
+    unsigned int lastBatch;     // 最近一次刷盘覆盖的提交数
+    unsigned int maxBatch;      // 单次刷盘覆盖的最大提交数
+
+    SyncStats()
+        : commits(0)
+        , flushes(0)
+        , lastBatch(0)
+        , maxBatch(0)
+    {}
+};
+
+class IoEngine;
+class Committer;
+class Segment;
+
+// 分配按IO_ALIGNMENT对齐的buffer，direct I/O要求对齐
+void *alignedAlloc(size_t size);
+// 释放alignedAlloc分配的buffer
+void alignedFree(void *buffer);
+// 按页分配一大块内存，huge时优先2MB大页，不可用时退回普通页，pages返回实际的页
+void *pageAlloc(size_t size, bool huge, int &pages);
+// 释放pageAlloc分配的内存，size、pages与分配时相同
+void pageFree(void *buffer, size_t size, int pages);
+// 把pageAlloc分配的内存中不再使用的一段还给系统，地址仍有效，再次访问时为0
+void pageDiscard(void *buffer, size_t size);
+
 class File
 {
   public:
-    HANDLE handle_; // 文件描述符句柄
+    static const unsigned int DEFAULT_IO_DEPTH = 64;       // 缺省异步队列深度
+    static const size_t IO_ALIGNMENT = 4096;               // direct I/O对齐大小
+    static const unsigned int DEFAULT_GROUP_WINDOW = 1000; // 组提交窗口1ms
+    static const unsigned int DEFAULT_GROUP_COUNT = 32;    // 组提交个数上限
+
+  public:
+    HANDLE handle_;              // 文件描述符句柄
+    IoEngine *engine_;           // 异步I/O引擎，NULL表示同步模式
+    unsigned char *map_;         // 只读映射，NULL表示未映射
+    unsigned long long mapSize_; // 映射长度
+    Committer *committer_;       // 提交器，NULL表示不刷盘
+    Segment *segment_;           // 内存段，NULL表示普通文件
+    unsigned long long id_;      // 打开序号，每次打开都不同，0表示未打开
+    unsigned int blockSize_;     // block大小，由表设定，0表示缺省
+    int algorithm_;              // block的checksum算法，由表设定，-1表示不检验
 
   public:
     File()
         : handle_(INVALID_HANDLE_VALUE)
+        , engine_(NULL)
+        , map_(NULL)
+        , mapSize_(0)
+        , committer_(NULL)
+        , segment_(NULL)
+        , id_(0)
+        , blockSize_(0)
+        , algorithm_(-1)
     {}
     ~File() { close(); }
 
-    // 打开文件
-    int open(const char *path);
+    // 打开文件，mode为OPEN_DIRECT时绕过页缓存，OPEN_MEMORY时打开同名内存段；
+    // OPEN_NOCREATE、OPEN_TRUNCATE只对文件系统上的文件有效
+    int open(const char *path, int mode = 0);
     // 关闭文件
     void close();
-    // 读文件
-    int read(unsigned long long offset, char *buffer, size_t length);
-    // 写文件
-    int write(unsigned long long offset, const char *buffer, size_t length);
+    // 读文件，bytes返回实际读取的长度，遇到文件尾时小于length
+    int read(
+        unsigned long long offset,
+        char *buffer,
+        size_t length,
+        size_t *bytes = NULL);
+    // 写文件，bytes返回实际写入的长度
+    int write(
+        unsigned long long offset,
+        const char *buffer,
+        size_t length,
+        size_t *bytes = NULL);
+    // 分散读，从offset开始依次填满iov，bytes返回实际读取的长度
+    int readv(
+        unsigned long long offset,
+        const struct iovec *iov,
+        int iovcnt,
+        size_t *bytes = NULL);
+    // 聚集写，把iov依次写到offset开始的连续区域
+    int writev(
+        unsigned long long offset,
+        const struct iovec *iov,
+        int iovcnt,
+        size_t *bytes = NULL);
+    // 为[offset, offset+length)预分配磁盘空间，文件随之变长
+    int allocate(unsigned long long offset, unsigned long long length);
+    // 释放[offset, offset+length)占用的磁盘空间，文件长度不变，之后读到0
+    int punch(unsigned long long offset, unsigned long long length);
+    // 把已写入的数据刷到磁盘
+    int sync();
     // 文件长度
     int length(unsigned long long &len);
     // 删除文件
     static int remove(const char *path);
+
+    // 把整个文件只读映射到内存，advice为访问模式提示；文件变长后可重新映射。
+    // 映射期间write/writev/allocate/punch和写请求返回EROFS
+    int map(int advice = MAP_ADVICE_NORMAL);
+    // 调整访问模式提示
+    int advise(int advice);
+    // 解除映射
+    void unmap();
+    // 是否已映射
+    inline bool mapped() const { return map_ != NULL; }
+    // 返回offset处长度为length的映射视图，越界返回NULL，视图不可写
+    inline unsigned char *view(
+        unsigned long long offset,
+        size_t length) const
+    {
+        if (map_ == NULL || offset + length > mapSize_) return NULL;
+        return map_ + offset;
+    }
+
+    // 设定持久性，组提交时窗口为window微秒或count个提交，先到为准
+    int setDurability(
+        int level,
+        unsigned int window = DEFAULT_GROUP_WINDOW,
+        unsigned int count = DEFAULT_GROUP_COUNT);
+    // 提交之前的写，按持久性设定决定是否、何时刷盘，可多线程并发调用
+    int commit();
+    // 刷盘统计
+    SyncStats syncStats();
+
+    // 打开异步模式，优先io_uring，不可用时退回线程池
+    int setAsync(
+        unsigned int depth = DEFAULT_IO_DEPTH,
+        int type = IO_ENGINE_URING);
+    // 是否处于异步模式
+    inline bool async() const { return engine_ != NULL; }
+    // 一次提交count个请求，要求异步模式
+    int submit(IoRequest *reqs, int count);
+    // 收割完成的请求，至少min个，至多max个，done返回实际个数
+    int complete(IoRequest **reqs, int max, int min, int &done);
+    // 提交count个请求并等待全部完成，同步模式下逐个执行；出错时也等全部
+    // 结束才返回，写不满的请求结果为EIO
+    int batch(IoRequest *reqs, int count);
 };
 
 } // namespace db
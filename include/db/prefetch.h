@@ -0,0 +1,90 @@
+////
+// @file prefetch.h
+// @brief
+// block链预读
+// 扫描沿着nextid逐个读block，每次都是一次同步读。预读器在消费者之前为后续block
+// 发起异步读：已经读到的block可以直接得到nextid，沿链继续向前；链上下一个block
+// 还没到时，以物理相邻的block作为提示填满窗口。一次前进发起的读请求一起提交。
+//
+// @author junix
+//
+#ifndef __DB_PREFETCH_H__
+#define __DB_PREFETCH_H__
+
+#include <vector>
+#include "./file.h"
+
+namespace db {
+
+class Prefetcher
+{
+  private:
+    // 预读帧
+    struct Frame
+    {
+        unsigned int blockid; // 对应的blockid，0表示空
+        bool inflight;        // 是否在读
+
+        Frame()
+            : blockid(0)
+            , inflight(false)
+        {}
+    };
+
+  private:
+    File *file_;                  // 所属文件
+    unsigned int window_;         // 窗口大小，0表示关闭
+    unsigned int size_;           // 文件的block大小
+    unsigned int next_;           // 下一个替换的帧
+    unsigned char *frames_;       // 帧buffer
+    std::vector<Frame> slots_;    // 帧描述
+    std::vector<IoRequest> reqs_; // 各帧的读请求，连续存放以便一起提交
+    unsigned long long hits_;     // 命中次数
+    unsigned long long misses_;   // 未命中次数
+
+  public:
+    Prefetcher()
+        : file_(NULL)
+        , window_(0)
+        , size_(0)
+        , next_(0)
+        , frames_(NULL)
+        , hits_(0)
+        , misses_(0)
+    {}
+    ~Prefetcher() { reset(NULL, 0); }
+
+    // 设定文件和窗口大小，window为0关闭预读；block大小取自文件
+    int reset(File *file, unsigned int window);
+    // 窗口大小
+    inline unsigned int window() const { return window_; }
+    // 取blockid，命中时拷贝到buffer并返回true，在读的帧会等待其完成
+    bool get(unsigned int blockid, unsigned char *buffer);
+    // 消费一个block之后，从其后继nextid开始发起预读，不超过第limit个block
+    void advance(unsigned int nextid, unsigned int limit);
+    // 丢弃所有帧，block被修改时调用
+    void invalidate();
+
+    // 命中次数
+    inline unsigned long long hits() const { return hits_; }
+    // 未命中次数
+    inline unsigned long long misses() const { return misses_; }
+
+  private:
+    // 查找blockid所在的帧
+    int find(unsigned int blockid);
+    // 等待帧读完
+    void wait(int index);
+    // 为blockid发起异步读
+    void issue(unsigned int blockid);
+    // 为blockid占一个帧并填写读请求，还不提交，返回帧下标
+    int prepare(unsigned int blockid);
+    // 一次提交从first开始的count个帧的读请求
+    void submit(int first, int count);
+    // 收割完成的读请求
+    void reap(int min);
+};
+
+} // namespace db
+
+#endif // __DB_PREFETCH_H__
@@ -0,0 +1,47 @@
+////
+// @file replacer.h
+// @brief
+// 缓冲池页面替换策略
+// LRU最简单，但一次全表扫描就会把热点页面全部挤出去。CLOCK用访问位近似LRU，
+// 命中时只置位，不移动链表。2Q把第一次访问的页面放进FIFO队列A1in，只有被换出后
+// 不久又被访问（记录在影子队列A1out中）的页面才进入LRU队列Am，扫描只会冲刷A1in。
+// 标记为只用一次（PIN_ONCE）的访问不提升页面，换出时也不进影子队列。
+// 替换器由缓冲池在持锁时调用，本身不加锁。
+//
+// @author junix
+//
+#ifndef __DB_REPLACER_H__
+#define __DB_REPLACER_H__
+
+#include "./buffer.h"
+
+namespace db {
+
+// 替换器接口
+class Replacer
+{
+  public:
+    virtual ~Replacer() {}
+
+    // 策略类型
+    virtual int type() const = 0;
+    // 设定页面数上限
+    virtual void resize(size_t capacity) { (void) capacity; }
+    // 新读入的页面，flags为pin时的标志
+    virtual void admit(Frame *frame, int flags) = 0;
+    // 命中的页面
+    virtual void touch(Frame *frame, int flags) = 0;
+    // 选择一个未pin的页面换出，并从替换器中移除，没有时返回NULL
+    virtual Frame *victim() = 0;
+    // victim选出但暂时不能换出的页面（脏页）放回，仍最先换出，不算作访问
+    virtual void putBack(Frame *frame) = 0;
+    // 移除页面，页面被丢弃时调用
+    virtual void remove(Frame *frame) = 0;
+};
+
+// 创建替换器，type见REPLACE_*
+Replacer *createReplacer(int type, size_t capacity);
+
+} // namespace db
+
+#endif // __DB_REPLACER_H__
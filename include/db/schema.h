@@ -9,6 +9,7 @@
 // 4. 各域的描述；（变长）
 // 5. 各种统计信息，表的大小，行数等；
 // meta.db的所有信息被读入一个map，以加快对元信息的访问。
+// 以映射模式打开时，直接从映射页面解析元信息，此时meta.db只读。
 //
 // @author niexw
 // @email niexiaowen@uestc.edu.cn
@@ -24,6 +25,8 @@
 
 namespace db {
 
+struct Frame;
+
 // 描述域
 struct FieldInfo
 {
@@ -77,25 +80,27 @@ class Schema
     std::string name_;      // 源文件名
     File metafile_;         // 元文件
     TableSpace tablespace_; // 表空间
-    unsigned char *buffer_; // block，TODO: 缓冲模块
+    unsigned char *buffer_; // 当前meta块的内容
+    Frame *page_;           // 当前meta块在缓冲池中的页面
+    int mode_;              // 元文件打开模式
 
   public:
     Schema(const char *name = META_FILE);
     ~Schema();
 
-    int open(); // 打开元文件并加载
+    // 打开元文件并加载，mapped表示只读映射，mode见File::open
+    int open(bool mapped = false, int mode = 0);
     int create(const char *table, RelationInfo &rel); // 新建一张表
     std::pair<TableSpace::iterator, bool> lookup(const char *table); // 查找表
-    int load(TableSpace::iterator it); // 加载表
+    // 加载表，内存中的schema其表也在内存中
+    int load(TableSpace::iterator it, int mode = 0);
 
     // 删除元文件
-    inline int destroy()
-    {
-        metafile_.close();
-        return metafile_.remove(name_.c_str());
-    }
+    int destroy();
 
   private:
+    // 放掉pin住的页面
+    void release();
     void initIov(const char *table, RelationInfo &rel, struct iovec *iov);
     void retrieveInfo(
         std::string &table,
@@ -106,8 +111,8 @@ class Schema
 
 // 全局唯一schema
 extern Schema gschema;
-// 系统初始化
-int dbInitialize();
+// 系统初始化，mode为OPEN_MEMORY时元文件和表都在内存中
+int dbInitialize(int mode = 0);
 
 } // namespace db
 
@@ -0,0 +1,80 @@
+////
+// @file segment.h
+// @brief
+// 内存段
+// OPEN_MEMORY打开的文件落在进程内可增长的内存段上，读写与文件语义一致：读到段尾
+// 返回短读，写超出段尾时段变长。段按路径登记，关闭后内容保留，同一路径再次打开
+// 得到同一个段；remove从登记表摘除，最后一个打开者关闭后释放，与unlink一致。
+// 映射期间段不能重新分配，超出容量的写返回EBUSY，已给出的视图一直有效。
+//
+// @author junix
+//
+#ifndef __DB_SEGMENT_H__
+#define __DB_SEGMENT_H__
+
+#include <mutex>
+#include "./file.h"
+
+namespace db {
+
+class Segment
+{
+  private:
+    std::mutex mutex_;         // 保护数据和长度
+    unsigned char *data_;      // 数据，按IO_ALIGNMENT对齐
+    unsigned long long size_;  // 长度
+    unsigned long long limit_; // 容量
+    unsigned int refs_;        // 打开次数，受登记表的锁保护
+    unsigned int maps_;        // 映射次数，大于0时不能重新分配
+    bool linked_;              // 是否还在登记表中
+
+  public:
+    // 按路径打开，不存在则创建
+    static Segment *attach(const char *path);
+    // 关闭，已删除且没有打开者时释放
+    static void detach(Segment *segment);
+    // 从登记表删除，不存在返回false
+    static bool unlink(const char *path);
+
+    // 读，bytes返回实际读取的长度
+    int read(
+        unsigned long long offset,
+        char *buffer,
+        size_t length,
+        size_t *bytes);
+    // 写，超出段尾时扩展，中间的空洞填0
+    int write(
+        unsigned long long offset,
+        const char *buffer,
+        size_t length,
+        size_t *bytes);
+    // 保证长度至少为length
+    int extend(unsigned long long length);
+    // 区间清0
+    int zero(unsigned long long offset, unsigned long long length);
+    // 长度
+    unsigned long long length();
+    // 数据起始地址，段变长后失效
+    unsigned char *data();
+    // 映射，返回数据起始地址，unmap之前段不会重新分配
+    unsigned char *map();
+    // 解除映射
+    void unmap();
+
+  private:
+    Segment()
+        : data_(NULL)
+        , size_(0)
+        , limit_(0)
+        , refs_(0)
+        , maps_(0)
+        , linked_(true)
+    {}
+    ~Segment() { alignedFree(data_); }
+    // 持锁调用，容量不足时按倍增长，映射期间返回EBUSY
+    int reserve(unsigned long long length);
+};
+
+} // namespace db
+
+#endif // __DB_SEGMENT_H__
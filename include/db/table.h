@@ -10,6 +10,8 @@
 #include <db/schema.h>
 #include <db/block.h>
 #include <db/record.h>
+#include <db/prefetch.h>
+#include <db/buffer.h>
 #include <string>
 #include <utility>
 #include <vector>
@@ -23,9 +25,6 @@ namespace db {
 // 表操作接口
 //
 
-//比较
-struct Compare;
-
 //表
 class Table
 {
@@ -37,45 +36,53 @@ class Table
 
   public:
     //友元类声明
-    friend struct Compare;
     friend struct iterator;
     friend struct blockIter;
 
   public:
+    // block迭代器，读block失败（如checksum不对）时记下错误，迭代到此结束，
+    // 之后等于blockEnd()，block不再可用
     struct blockIter
     {
       private:
         unsigned int blockid; // block位置
         Table &table;
         DataBlock block;
+        int flags; // 缓冲池pin标志，扫描时为PIN_ONCE
+        int error; // 读block的错误，S_OK表示没有
 
       public:
         friend struct iterator;
 
       public:
-        blockIter(unsigned int bid, Table &itable)
+        blockIter(unsigned int bid, Table &itable, int iflags = 0)
             : blockid(bid)
             , table(itable)
+            , flags(iflags)
+            , error(S_OK)
         {}
         blockIter(const blockIter &o)
             : blockid(o.blockid)
             , table(o.table)
+            , flags(o.flags)
+            , error(o.error)
         {}
         ~blockIter() {}
         unsigned int getBlockid() { return blockid; }
+        // 迭代因读block失败而结束时返回错误码
+        int getError() const { return error; }
         blockIter &operator=(const blockIter &o)
         {
             blockid = o.blockid;
             table = o.table;
+            flags = o.flags;
+            error = o.error;
             return *this;
         }
         blockIter &operator++() // 前缀
         {
-            size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-            table.relationInfo->file.read(
-                offset, (char *) table.buffer_, Block::BLOCK_SIZE);
-            block.attach(table.buffer_);
-            if (blockid != -1) blockid = block.getNextid();
+            if (blockid == (unsigned int) -1) return *this;
+            if (fetch()) blockid = block.getNextid();
             return *this;
         }
         blockIter operator++(int) // 后缀
@@ -92,14 +99,26 @@ class Table
         {
             return blockid != rhs.blockid;
         }
+        // 出错之后不再读，返回的block不可用
         DataBlock &operator*()
         {
-            size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-            table.relationInfo->file.read(
-                offset, (char *) table.buffer_, Block::BLOCK_SIZE);
-            block.attach(table.buffer_);
+            if (blockid != (unsigned int) -1) fetch();
             return block;
         }
+
+      private:
+        // 读入当前block，失败时记下错误并结束迭代
+        bool fetch()
+        {
+            unsigned char *data;
+            error = table.fetch(blockid, data, flags);
+            if (error) {
+                blockid = (unsigned int) -1;
+                return false;
+            }
+            block.attach(data, table.blockSize_, table.algorithm_);
+            return true;
+        }
     };
     struct iterator
     {
@@ -115,12 +134,13 @@ class Table
             : sloti{si}
             , blockit(iblockit)
         {
-            slotmax = (*blockit).getSlotsNum() - 1;
+            DataBlock &block = *blockit;
+            slotmax = blockit.error ? 0 : block.getSlotsNum() - 1;
         }
         iterator(const iterator &o)
             : sloti(o.sloti)
-            , blockit(o.blockit)
             , slotmax(o.slotmax)
+            , blockit(o.blockit)
         {}
         iterator &operator=(const iterator &o)
         {
@@ -159,11 +179,15 @@ class Table
             //     block = *blockit;
             // }
             unsigned short reoff = block.getSlot(sloti);
-            record.attach(blockit.table.buffer_ + reoff, Block::BLOCK_SIZE);
+            record.attach(block.buffer() + reoff, block.size() - reoff);
             return record;
         }
     };
 
+  public:
+    static const unsigned int DEFAULT_EXTENT_BLOCKS = 64; // 缺省预分配64个block
+    static const char *WARM_SUFFIX; // 预热列表文件后缀
+
   public:
     Table();
     ~Table();
@@ -171,9 +195,10 @@ class Table
   public:
     // 创建表
     int create(const char *name, RelationInfo &info);
-    // 打开一张表
-    int open(const char *name);
-    //关闭一张表
+    // 打开一张表，mode为OPEN_DIRECT时绕过页缓存；按上次关闭时缓冲的block
+    // 列表并行预读，预热缓冲池。旧格式的文件返回ENOTSUP
+    int open(const char *name, int mode = 0);
+    //关闭一张表，关闭前保存缓冲的block列表
     void close(const char *name);
     //摧毁一张表
     int destroy(const char *name);
@@ -181,86 +206,154 @@ class Table
     int initial();
     //创建新datablock
     int creatDataBlock(int blockid, int &newid);
-    //分裂datablock
-    int splitDataBlock(int blockid);
+    //分裂datablock，前count条记录留在原block，0表示对半分
+    int splitDataBlock(int blockid, unsigned short count = 0);
     //!返回当前block的id,测试需要
     int blockid();
     //!返回当前block的空闲空间,测试需要
     unsigned short freelength();
     //!返回当前block的slotsNum,测试需要
     unsigned short slotsNum();
-    //写block
+    //写block，标脏后由缓冲池写回
     int writeBlock();
     //更新root
     int writeRoot();
     // 插入一条记录
     int insert(const unsigned char *header, struct iovec *record, int iovcnt);
+    // 按key查找一条记录，字段拷贝到record中，iov_len为buffer长度，返回时为
+    // 字段长度；找不到返回S_FALSE，buffer不够返回EINVAL
+    int get(
+        struct iovec keyField,
+        unsigned char *header,
+        struct iovec *record,
+        int iovcnt);
     //删除一条记录
     int remove(struct iovec keyField);
+    // 设定block链扫描的预读窗口，0关闭预读
+    int setReadahead(unsigned int window);
+    // 预读命中次数
+    inline unsigned long long readaheadHits() const { return prefetch_.hits(); }
+    // 预读未命中次数
+    inline unsigned long long readaheadMisses() const
+    {
+        return prefetch_.misses();
+    }
+    // 设定每次预分配的block数目
+    void setExtent(unsigned int blocks);
+    // 设定block大小，须为4KB到64KB之间2的幂，open之后、第一次写之前调用；
+    // 大小记在root中，之后open时读出。已有数据时返回EBUSY
+    int setBlockSize(unsigned int size);
+    // block大小
+    inline unsigned int blockSize() const { return blockSize_; }
+    // 设定block的checksum算法，缺省为CHECKSUM_CRC32C，与setBlockSize一样
+    // 在第一次写之前调用，记在root中
+    int setChecksumAlgorithm(int algorithm);
+    // block的checksum算法
+    inline int checksumAlgorithm() const { return algorithm_; }
+    // 保存缓冲池中本表的block列表，下次open时预热；close时自动保存，
+    // 也可以定期调用
+    int dumpBuffer();
+    // 回收空block时是否释放其磁盘空间（打洞）；block头部所在的4KB保留，
+    // 4KB的block没有可释放的部分，不打洞
+    inline void setPunch(bool punch) { punch_ = punch; }
+    // 设定持久性，见File::setDurability
+    int setDurability(
+        int level,
+        unsigned int window = File::DEFAULT_GROUP_WINDOW,
+        unsigned int count = File::DEFAULT_GROUP_COUNT);
+    // 只读映射模式，扫描直接访问映射页面，期间不允许修改
+    int map(int advice = MAP_ADVICE_SEQUENTIAL);
+    // 退出映射模式
+    void unmap();
     //更新一条记录
     int update(
         struct iovec keyField,
         const unsigned char *header,
         struct iovec *record,
         int iovcnt);
-    // block begin、end
-    blockIter blockBegin()
+    // block begin、end，全表扫描时flags为PIN_ONCE，避免冲刷缓冲池中的热点
+    blockIter blockBegin(int flags = 0)
     {
-        relationInfo->file.read(0, (char *) buffer_, Root::ROOT_SIZE);
-        Root root;
-        root.attach(buffer_);
-        return blockIter(root.getHead(), *this);
+        return blockIter(head(), *this, flags);
     }
     blockIter blockEnd() { return blockIter(-1, *this); }
     // begin, end
     iterator begin(blockIter &blockIt) { return iterator(0, blockIt); }
+    // block读不出时begin等于end
     iterator end(blockIter &blockIt)
     {
         DataBlock block = *blockIt;
+        if (blockIt.getError()) return iterator(0, blockIt);
         unsigned short slotsnum = block.getSlotsNum();
         return iterator(slotsnum, blockIt);
     }
 
-    // front,back
-    Record &front(blockIter &blockIt) { return *begin(blockIt); }
-    Record &back(blockIter &blockIt) { return *last(blockIt); }
+    // front,back，返回拷贝，迭代器是临时对象
+    Record front(blockIter &blockIt) { return *begin(blockIt); }
+    Record back(blockIter &blockIt) { return *last(blockIt); }
 
   private:
+    // open时从root读出block大小和checksum算法，新表为缺省设定；
+    // 格式版本不是当前版本时返回ENOTSUP
+    int loadFormat();
+    // 切换到size大小的block
+    int applyBlockSize(unsigned int size);
+    // 保证前count个block已预分配，不足时按extent扩展，调用者持有root的写latch
+    int reserve(unsigned int count);
+    // 分配一个新block，优先取空闲链，frame返回pin住的页面
+    int takeBlock(unsigned int &blockid, Frame *&frame);
+    // buffer_中的空block从链上摘下，放入空闲链，prev为前驱，0表示链头
+    int freeBlock(unsigned int blockid, unsigned int prev);
+    // 获取block，映射模式下data为映射视图，否则作为当前block pin住；
+    // 读失败或检验不过时返回错误码
+    int fetch(unsigned int blockid, unsigned char *&data, int flags = 0);
+    // 把blockid pin住作为当前block，buffer_指向其内容
+    int load(unsigned int blockid, int flags = 0);
+    // block链头
+    unsigned int head();
+    // 放掉pin住的页面
+    void release();
+    // 修改完成，脏页过多时等待写回，再按持久性设定刷盘
+    int commit();
+    // key字段的数据类型
+    DataType *keyType();
+    // 找到key所在的block，作为当前block，data关联其内容；slotid返回其slot，
+    // prev为前驱blockid，0表示链头；找不到返回S_FALSE，读block失败返回错误码
+    int locate(
+        struct iovec keyField,
+        DataBlock &data,
+        unsigned int &blockid,
+        unsigned int &prev,
+        unsigned short &slotid);
+    // 在bit所指的block中按key有序插入记录，放不下时分裂后在落入的一半中重试，
+    // 空block也放不下时返回EINVAL；成功返回时持有当前页面的写latch，
+    // data关联当前页面，bit可能前移到分裂出的新block
+    int place(
+        blockIter &bit,
+        DataBlock &data,
+        const unsigned char *header,
+        struct iovec *record,
+        int iovcnt);
     iterator last(blockIter &blockIt)
     {
         DataBlock block = *blockIt;
+        if (blockIt.getError()) return iterator(0, blockIt);
         unsigned short slotsnum = block.getSlotsNum();
         return iterator(slotsnum - 1, blockIt);
     }
     unsigned int DataBlockCnt;  // datablock数目
+    unsigned int allocated_;    // 已预分配的block数目
+    unsigned int extent_;       // 每次预分配的block数目
+    bool punch_;                // 回收block时是否打洞
     RelationInfo *relationInfo; //表信息
-    unsigned char *buffer_;     // block，TODO: 缓冲模块
-};
-struct Compare
-{
-  private:
-    FieldInfo &fin;
-    unsigned int key;
-    Table &table;
-
-  public:
-    Compare(FieldInfo &f, unsigned int k, Table &itable)
-        : fin(f)
-        , key(k)
-        , table(itable)
-    {}
-    bool operator()(const unsigned short &x, const unsigned short &y) const
-    {
-        //根据x, y偏移量，引用两条记录；
-        Record rx, ry;
-        rx.attach(table.buffer_ + x, Block::BLOCK_SIZE);
-        ry.attach(table.buffer_ + y, Block::BLOCK_SIZE);
-        iovec keyx, keyy;
-        rx.specialRef(keyx, key);
-        ry.specialRef(keyy, key);
-        return fin.type->compare(
-            keyx.iov_base, keyy.iov_base, keyx.iov_len, keyy.iov_len);
-    }
+    unsigned char *buffer_;     // 当前block的内容
+    unsigned char *root_;       // root的内容
+    Frame *page_;               // 当前block在缓冲池中的页面
+    Frame *rootPage_;           // root在缓冲池中的页面
+    unsigned char *split_;      // 分裂时使用的block
+    unsigned int blockSize_;    // block大小
+    int algorithm_;             // block的checksum算法
+    Prefetcher prefetch_;       // block链预读
 };
 } // namespace db
 
@@ -0,0 +1,437 @@
+////
+// @file aio.cc
+// @brief
+// 实现异步I/O引擎
+//
+// @author junix
+//
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <db/aio.h>
+#if defined(__linux__)
+#    include <unistd.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <linux/io_uring.h>
+#endif
+
+namespace db {
+
+////
+// @brief
+// 线程池引擎，工作线程同步执行File::read/write
+//
+class ThreadEngine : public IoEngine
+{
+  private:
+    std::vector<std::thread> workers_; // 工作线程
+    std::mutex mutex_;                  // 保护队列
+    std::condition_variable work_;      // 有新请求
+    std::condition_variable finish_;    // 有请求完成
+    std::deque<IoRequest *> queue_;     // 待执行请求
+    std::deque<IoRequest *> ready_;     // 已完成未收割请求
+    size_t outstanding_;                // 已提交未收割个数
+    bool stop_;                         // 退出标志
+
+  public:
+    ThreadEngine(File *file, unsigned int depth)
+        : IoEngine(file)
+        , outstanding_(0)
+        , stop_(false)
+    {
+        unsigned int count = depth < 4 ? depth : 4;
+        if (count == 0) count = 1;
+        for (unsigned int i = 0; i < count; ++i)
+            workers_.push_back(std::thread(&ThreadEngine::run, this));
+    }
+    ~ThreadEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i)
+            workers_[i].join();
+    }
+
+    int type() const { return IO_ENGINE_THREADS; }
+
+    int submit(IoRequest *reqs, int count)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int i = 0; i < count; ++i) {
+                reqs[i].bytes = 0;
+                reqs[i].result = S_OK;
+                queue_.push_back(&reqs[i]);
+            }
+            outstanding_ += count;
+        }
+        work_.notify_all();
+        return S_OK;
+    }
+
+    int complete(IoRequest **reqs, int max, int min, int &done)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        size_t want = (size_t) min < outstanding_ ? (size_t) min : outstanding_;
+        while (ready_.size() < want)
+            finish_.wait(lock);
+        done = 0;
+        while (done < max && !ready_.empty()) {
+            reqs[done++] = ready_.front();
+            ready_.pop_front();
+        }
+        outstanding_ -= done;
+        return S_OK;
+    }
+
+    void quiesce()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!queue_.empty()) {
+            IoRequest *req = queue_.front();
+            queue_.pop_front();
+            req->result = ECANCELED;
+            ready_.push_back(req);
+        }
+        while (ready_.size() < outstanding_)
+            finish_.wait(lock);
+    }
+
+  private:
+    void run()
+    {
+        for (;;) {
+            IoRequest *req;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!stop_ && queue_.empty())
+                    work_.wait(lock);
+                if (stop_) return;
+                req = queue_.front();
+                queue_.pop_front();
+            }
+            if (req->opcode == IO_READ)
+                req->result = file_->read(
+                    req->offset, req->buffer, req->length, &req->bytes);
+            else
+                req->result = file_->write(
+                    req->offset, req->buffer, req->length, &req->bytes);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ready_.push_back(req);
+            }
+            finish_.notify_all();
+        }
+    }
+};
+
+#if defined(__linux__) && defined(IORING_FEAT_FAST_POLL)
+
+////
+// @brief
+// io_uring引擎，直接使用系统调用，不依赖liburing
+// IORING_FEAT_FAST_POLL（5.7）之后的内核都支持IORING_OP_READ/WRITE。
+//
+class UringEngine : public IoEngine
+{
+  private:
+    int ring_;             // io_uring描述符
+    unsigned int sqCnt_;   // sq大小
+    unsigned int cqCnt_;   // cq大小
+    unsigned int *sqHead_; // sq头
+    unsigned int *sqTail_; // sq尾
+    unsigned int *sqMask_; // sq掩码
+    unsigned int *sqArray_;     // sq索引数组
+    struct io_uring_sqe *sqes_; // sqe数组
+    unsigned int *cqHead_;      // cq头
+    unsigned int *cqTail_;      // cq尾
+    unsigned int *cqMask_;      // cq掩码
+    struct io_uring_cqe *cqes_; // cqe数组
+    void *sqRing_;              // sq映射
+    void *cqRing_;              // cq映射
+    size_t sqSize_;             // sq映射大小
+    size_t cqSize_;             // cq映射大小
+    size_t sqesSize_;           // sqe映射大小
+    unsigned int pending_;      // 已填入sq未提交个数
+    unsigned int inflight_;     // 已提交未完成个数
+    std::deque<IoRequest *> ready_; // 已完成未收割请求
+    std::deque<IoRequest *> retry_; // 收割时sq已满，等待重新入队的请求
+
+  public:
+    UringEngine(File *file)
+        : IoEngine(file)
+        , ring_(-1)
+        , sqes_(NULL)
+        , sqRing_(MAP_FAILED)
+        , cqRing_(MAP_FAILED)
+        , pending_(0)
+        , inflight_(0)
+    {}
+    ~UringEngine()
+    {
+        if (sqes_) ::munmap(sqes_, sqesSize_);
+        if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_)
+            ::munmap(cqRing_, cqSize_);
+        if (sqRing_ != MAP_FAILED) ::munmap(sqRing_, sqSize_);
+        if (ring_ >= 0) ::close(ring_);
+    }
+
+    int init(unsigned int depth)
+    {
+        struct io_uring_params params;
+        ::memset(&params, 0, sizeof(params));
+        ring_ = (int) ::syscall(__NR_io_uring_setup, depth, &params);
+        if (ring_ < 0) return errno;
+        if (!(params.features & IORING_FEAT_FAST_POLL)) return ENOSYS;
+        sqCnt_ = params.sq_entries;
+        cqCnt_ = params.cq_entries;
+
+        // 映射sq、cq，新内核可以一次映射
+        sqSize_ = params.sq_off.array + sqCnt_ * sizeof(unsigned int);
+        cqSize_ = params.cq_off.cqes + cqCnt_ * sizeof(struct io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            if (cqSize_ > sqSize_) sqSize_ = cqSize_;
+            cqSize_ = sqSize_;
+        }
+        sqRing_ = ::mmap(
+            NULL,
+            sqSize_,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            ring_,
+            IORING_OFF_SQ_RING);
+        if (sqRing_ == MAP_FAILED) return errno;
+        if (single)
+            cqRing_ = sqRing_;
+        else {
+            cqRing_ = ::mmap(
+                NULL,
+                cqSize_,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE,
+                ring_,
+                IORING_OFF_CQ_RING);
+            if (cqRing_ == MAP_FAILED) return errno;
+        }
+        sqesSize_ = sqCnt_ * sizeof(struct io_uring_sqe);
+        void *sqes = ::mmap(
+            NULL,
+            sqesSize_,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            ring_,
+            IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return errno;
+        sqes_ = (struct io_uring_sqe *) sqes;
+
+        unsigned char *sq = (unsigned char *) sqRing_;
+        sqHead_ = (unsigned int *) (sq + params.sq_off.head);
+        sqTail_ = (unsigned int *) (sq + params.sq_off.tail);
+        sqMask_ = (unsigned int *) (sq + params.sq_off.ring_mask);
+        sqArray_ = (unsigned int *) (sq + params.sq_off.array);
+        unsigned char *cq = (unsigned char *) cqRing_;
+        cqHead_ = (unsigned int *) (cq + params.cq_off.head);
+        cqTail_ = (unsigned int *) (cq + params.cq_off.tail);
+        cqMask_ = (unsigned int *) (cq + params.cq_off.ring_mask);
+        cqes_ = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+        return S_OK;
+    }
+
+    int type() const { return IO_ENGINE_URING; }
+
+    int submit(IoRequest *reqs, int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            // sq满或cq可能溢出时，先提交并收割一部分
+            while (sqFull() || outstanding() >= cqCnt_) {
+                int ret = enter(pending_, 1);
+                if (ret) return ret;
+                reap();
+                drain();
+            }
+            reqs[i].bytes = 0;
+            reqs[i].result = S_OK;
+            prepare(&reqs[i]);
+        }
+        return enter(pending_, 0);
+    }
+
+    int complete(IoRequest **reqs, int max, int min, int &done)
+    {
+        reap();
+        drain();
+        while (ready_.size() < (size_t) min && outstanding() > 0) {
+            int ret = enter(pending_, 1);
+            if (ret) return ret;
+            reap();
+            drain();
+        }
+        done = 0;
+        while (done < max && !ready_.empty()) {
+            reqs[done++] = ready_.front();
+            ready_.pop_front();
+        }
+        // 提交收割时重新入队的请求
+        return enter(pending_, 0);
+    }
+
+    void quiesce()
+    {
+        for (;;) {
+            // 还没交给内核的请求直接放弃，收割时重新入队的也一样
+            cancel();
+            if (inflight_ == 0) return;
+            // io_uring_enter出错时让出CPU，内核完成的请求照样写入cq
+            if (enter(0, 1)) std::this_thread::yield();
+            reap();
+        }
+    }
+
+  private:
+    // sq是否已满
+    inline bool sqFull()
+    {
+        unsigned int head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        return *sqTail_ - head == sqCnt_;
+    }
+
+    // 已交给引擎还没有收割的请求数，包括等待重新入队的
+    inline unsigned int outstanding()
+    {
+        return inflight_ + pending_ + (unsigned int) retry_.size();
+    }
+
+    // 重新入队，sq已满时先放入retry_，已填好还没提交的sqe不能覆盖
+    void requeue(IoRequest *req)
+    {
+        if (sqFull())
+            retry_.push_back(req);
+        else
+            prepare(req);
+    }
+
+    // retry_中的请求按顺序重新入队，直到sq满
+    void drain()
+    {
+        while (!retry_.empty() && !sqFull()) {
+            prepare(retry_.front());
+            retry_.pop_front();
+        }
+    }
+
+    // 收回sq中还没提交的sqe和retry_中的请求，结果为ECANCELED；
+    // 内核只在io_uring_enter时读sq尾，收回未提交的sqe是安全的
+    void cancel()
+    {
+        unsigned int tail = *sqTail_;
+        for (unsigned int i = pending_; i > 0; --i) {
+            struct io_uring_sqe *sqe = &sqes_[(tail - i) & *sqMask_];
+            abandon((IoRequest *) sqe->user_data);
+        }
+        __atomic_store_n(sqTail_, tail - pending_, __ATOMIC_RELEASE);
+        pending_ = 0;
+        while (!retry_.empty()) {
+            abandon(retry_.front());
+            retry_.pop_front();
+        }
+    }
+
+    // 放弃一个请求，交给调用者收割
+    void abandon(IoRequest *req)
+    {
+        if (req->result == S_OK) req->result = ECANCELED;
+        ready_.push_back(req);
+    }
+
+    // 填写一个sqe，剩余部分从bytes处开始
+    void prepare(IoRequest *req)
+    {
+        unsigned int tail = *sqTail_;
+        unsigned int index = tail & *sqMask_;
+        struct io_uring_sqe *sqe = &sqes_[index];
+        ::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = req->opcode == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = file_->handle_;
+        sqe->addr = (unsigned long long) (req->buffer + req->bytes);
+        sqe->len = (unsigned int) (req->length - req->bytes);
+        sqe->off = req->offset + req->bytes;
+        sqe->user_data = (unsigned long long) req;
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+        ++pending_;
+    }
+
+    // 提交submit个sqe，等待至少wait个完成
+    int enter(unsigned int submit, unsigned int wait)
+    {
+        while (submit > 0 || wait > 0) {
+            unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+            int ret = (int) ::syscall(
+                __NR_io_uring_enter, ring_, submit, wait, flags, NULL, 0);
+            if (ret < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return errno;
+            }
+            pending_ -= ret;
+            inflight_ += ret;
+            submit -= ret;
+            if (submit == 0) break;
+        }
+        return S_OK;
+    }
+
+    // 收割cq，短读写的剩余部分重新入队
+    void reap()
+    {
+        unsigned int head = *cqHead_;
+        unsigned int tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &cqes_[head & *cqMask_];
+            IoRequest *req = (IoRequest *) cqe->user_data;
+            int res = cqe->res;
+            ++head;
+            --inflight_;
+            if (res == -EINTR || res == -EAGAIN) {
+                requeue(req);
+                continue;
+            }
+            if (res < 0)
+                req->result = -res;
+            else if (res == 0 && req->opcode == IO_WRITE)
+                req->result = EIO; // 写不会遇到文件尾，没有进展作为失败
+            else {
+                req->bytes += res;
+                // 读返回0表示文件尾
+                if (res > 0 && req->bytes < req->length) {
+                    requeue(req);
+                    continue;
+                }
+            }
+            ready_.push_back(req);
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    }
+};
+
+#endif // __linux__
+
+IoEngine *createIoEngine(File *file, unsigned int depth, int type)
+{
+#if defined(__linux__) && defined(IORING_FEAT_FAST_POLL)
+    if (type == IO_ENGINE_URING) {
+        UringEngine *engine = new UringEngine(file);
+        if (engine->init(depth) == S_OK) return engine;
+        delete engine; // 内核不支持，退回线程池
+    }
+#endif
+    return new ThreadEngine(file, depth);
+}
+
+} // namespace db
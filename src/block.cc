@@ -6,18 +6,35 @@
 // @author niexw、junix
 //
 
+#include <algorithm>
+#include <vector>
 #include <db/block.h>
 #include <db/record.h>
-#include <db/block.h>
 
 namespace db {
 
+// 被引用（odr-use）的静态常量需要类外定义
+const int Block::BLOCK_SIZE;
+const short Block::BLOCK_DEFAULT_FREESPACE;
+const int Block::BLOCK_DEFAULT_CHECKSUM;
+const short MetaBlock::META_DEFAULT_FREESPACE;
+const short DataBlock::DATA_DEFAULT_FREESPACE;
+const unsigned short DataBlock::DATA_FENCE_OVERFLOW;
+const unsigned int Root::FORMAT_VERSION;
+
+// 记录占用的空间，按8B对齐
+static inline unsigned short alignOf(size_t length)
+{
+    return (unsigned short) ((length + Record::ALIGN_SIZE - 1) /
+                             Record::ALIGN_SIZE * Record::ALIGN_SIZE);
+}
+
 void Block::clear(int spaceid, int blockid)
 {
     spaceid = htobe32(spaceid);
     blockid = htobe32(blockid);
     // 清buffer
-    ::memset(buffer_, 0, BLOCK_SIZE);
+    ::memset(buffer_, 0, size_);
     // 设置magic number
     ::memcpy(
         buffer_ + BLOCK_MAGIC_OFFSET, &BLOCK_MAGIC_NUMBER, BLOCK_MAGIC_SIZE);
@@ -28,9 +45,13 @@ void Block::clear(int spaceid, int blockid)
     // 设置freespace
     unsigned short data = htobe16(BLOCK_DEFAULT_FREESPACE);
     ::memcpy(buffer_ + BLOCK_FREESPACE_OFFSET, &data, BLOCK_FREESPACE_SIZE);
-    // 设置checksum
-    int checksum = BLOCK_DEFAULT_CHECKSUM;
-    ::memcpy(buffer_ + BLOCK_CHECKSUM_OFFSET, &checksum, BLOCK_CHECKSUM_SIZE);
+    // 设置checksum，32位和为预先算好的值
+    if (algorithm_ == CHECKSUM_CRC32C)
+        setChecksum();
+    else {
+        int checksum = BLOCK_DEFAULT_CHECKSUM;
+        ::memcpy(buffer_ + trailer(), &checksum, BLOCK_CHECKSUM_SIZE);
+    }
 }
 
 void Root::clear(unsigned short type)
@@ -59,7 +80,7 @@ void MetaBlock::clear(unsigned int blockid)
     unsigned int spaceid = 0xffffffff; // -1表示meta
     blockid = htobe32(blockid);
     // 清buffer
-    ::memset(buffer_, 0, BLOCK_SIZE);
+    ::memset(buffer_, 0, size_);
     // 设置magic number
     ::memcpy(
         buffer_ + BLOCK_MAGIC_OFFSET, &BLOCK_MAGIC_NUMBER, BLOCK_MAGIC_SIZE);
@@ -80,7 +101,7 @@ void DataBlock::clear(unsigned int blockid)
     unsigned int spaceid = 0x00000001; //!! -1表示meta
     blockid = htobe32(blockid);
     // 清buffer
-    ::memset(buffer_, 0, BLOCK_SIZE);
+    ::memset(buffer_, 0, size_);
     // 设置magic number
     ::memcpy(
         buffer_ + BLOCK_MAGIC_OFFSET, &BLOCK_MAGIC_NUMBER, BLOCK_MAGIC_SIZE);
@@ -101,30 +122,237 @@ void DataBlock::clear(unsigned int blockid)
 
 bool Block::allocate(const unsigned char *header, struct iovec *iov, int iovcnt)
 {
-    // 判断是否有空间
-    unsigned short length = getFreeLength();
-    if (length == 0) return false;
+    return allocate(header, iov, iovcnt, getSlotsNum());
+}
 
-    // 判断能否分配
+bool Block::allocate(
+    const unsigned char *header,
+    struct iovec *iov,
+    int iovcnt,
+    unsigned short index)
+{
+    // 记录按8B对齐
     std::pair<size_t, size_t> ret = Record::size(iov, iovcnt);
-    length -= 2; // 一个slot占2字节
-    if (ret.first > length) return false;
+    size_t need = alignOf(ret.first);
+    unsigned short length = getFreeLength();
+    if (length < sizeof(unsigned short)) return false; // 一个slot占2字节
+
+    // 先在空闲链表中找最合适的空间，找不到再用freespace
+    unsigned short offset = takeGarbage((unsigned short) need);
+    if (offset == 0) {
+        // freespace不够但加上空闲链表够时，整理block
+        if (length < need + sizeof(unsigned short) &&
+            length + getGarbageLength() >= need + sizeof(unsigned short)) {
+            compact();
+            length = getFreeLength();
+        }
+        if (length < need + sizeof(unsigned short)) return false;
+        offset = getFreespace();
+        setFreespace((unsigned short) (offset + need));
+    }
 
     // 写入记录
     Record record;
-    unsigned short oldf = getFreespace();
-    record.attach(buffer_ + oldf, length);
-    unsigned short pos = (unsigned short) record.set(iov, iovcnt, header);
+    record.attach(buffer_ + offset, (unsigned short) need);
+    record.set(iov, iovcnt, header);
 
-    // 调整freespace
-    setFreespace(pos + oldf);
-    // 写slot
+    // slots[]从下向上存放，index及之后的slot整体下移一格，空出第index个
     unsigned short slots = getSlotsNum();
-    setSlotsNum(slots + 1); // 增加slots数目
-    setSlot(slots, oldf);   // 第slots个
+    if (index > slots) index = slots;
+    unsigned int last = trailer() - slots * sizeof(unsigned short);
+    ::memmove(
+        buffer_ + last - sizeof(unsigned short),
+        buffer_ + last,
+        (slots - index) * sizeof(unsigned short));
+    setSlotsNum(slots + 1);
+    setSlot(index, offset);
 
-    // slots未排序，同时需要setChecksum
+    // 需要setChecksum
     return true;
 }
 
+void Block::eraseSlot(unsigned short index)
+{
+    unsigned short slots = getSlotsNum();
+    if (index >= slots) return;
+    // slots[]从下向上存放，index之后的slot整体上移一格
+    unsigned int last = trailer() - slots * sizeof(unsigned short);
+    ::memmove(
+        buffer_ + last + sizeof(unsigned short),
+        buffer_ + last,
+        (slots - index - 1) * sizeof(unsigned short));
+    setSlotsNum(slots - 1);
+}
+
+void Block::deallocate(unsigned short index)
+{
+    if (index >= getSlotsNum()) return;
+    unsigned short offset = getSlot(index);
+    unsigned short size = recordLength(offset);
+    eraseSlot(index);
+    // 紧挨着freespace的直接并入，否则放入空闲链表
+    if (offset + size == getFreespace())
+        setFreespace(offset);
+    else {
+        setChunk(offset, getGarbage(), size);
+        setGarbage(offset);
+    }
+}
+
+unsigned short Block::getGarbageLength()
+{
+    unsigned int total = 0;
+    for (unsigned short offset = getGarbage(); offset;
+         offset = getChunkNext(offset))
+        total += getChunkSize(offset);
+    return (unsigned short) total;
+}
+
+void Block::compact()
+{
+    // 记录和空闲空间从start开始连续存放，按偏移量排序后依次前移
+    unsigned short slots = getSlotsNum();
+    std::vector<std::pair<unsigned short, unsigned short>> order(slots);
+    for (unsigned short i = 0; i < slots; ++i)
+        order[i] = std::make_pair(getSlot(i), i);
+    std::sort(order.begin(), order.end());
+    unsigned short start = getFreespace();
+    if (slots) start = order[0].first;
+    for (unsigned short offset = getGarbage(); offset;
+         offset = getChunkNext(offset))
+        if (offset < start) start = offset;
+
+    unsigned short pos = start;
+    for (unsigned short i = 0; i < slots; ++i) {
+        unsigned short offset = order[i].first;
+        unsigned short size = recordLength(offset);
+        if (offset != pos) ::memmove(buffer_ + pos, buffer_ + offset, size);
+        setSlot(order[i].second, pos);
+        pos += size;
+    }
+    setFreespace(pos);
+    setGarbage(0);
+}
+
+unsigned short Block::takeGarbage(unsigned short size)
+{
+    // 最佳适配，prev为前驱，0表示链头
+    unsigned short best = 0, bestPrev = 0, prev = 0;
+    for (unsigned short offset = getGarbage(); offset;
+         prev = offset, offset = getChunkNext(offset)) {
+        unsigned short chunk = getChunkSize(offset);
+        if (chunk < size) continue;
+        if (best == 0 || chunk < getChunkSize(best)) {
+            best = offset;
+            bestPrev = prev;
+            if (chunk == size) break;
+        }
+    }
+    if (best == 0) return 0;
+
+    // 多出的部分留在链表中原来的位置
+    unsigned short next = getChunkNext(best);
+    unsigned short rest = getChunkSize(best) - size;
+    if (rest) {
+        setChunk(best + size, next, rest);
+        next = best + size;
+    }
+    if (bestPrev)
+        setChunk(bestPrev, next, getChunkSize(bestPrev));
+    else
+        setGarbage(next);
+    return best;
+}
+
+unsigned short Block::recordLength(unsigned short offset)
+{
+    Record record;
+    record.attach(buffer_ + offset, (unsigned short) (size_ - offset));
+    return alignOf(record.length());
+}
+
+bool DataBlock::getKey(unsigned short index, unsigned int key, iovec &field)
+{
+    Record record;
+    record.attach(
+        buffer_ + getSlot(index), (unsigned short) (size_ - getSlot(index)));
+    return record.specialRef(field, key);
+}
+
+bool DataBlock::insert(
+    unsigned int key,
+    DataType *type,
+    const unsigned char *header,
+    struct iovec *iov,
+    int iovcnt)
+{
+    bool found;
+    unsigned short index = search(key, type, iov[key], found);
+    if (!allocate(header, iov, iovcnt, index)) return false;
+    // 新的最小、最大key直接取自iov，不解析记录
+    if (index == 0) setLow(&iov[key]);
+    if (index == getSlotsNum() - 1) setHigh(&iov[key]);
+    return true;
+}
+
+bool DataBlock::fits(const struct iovec *iov, int iovcnt)
+{
+    std::pair<size_t, size_t> ret = Record::size(iov, iovcnt);
+    size_t need = alignOf(ret.first) + sizeof(unsigned short);
+    return need <= trailer() - (unsigned int) BLOCK_DATA_START;
+}
+
+void DataBlock::remove(unsigned int key, unsigned short index)
+{
+    unsigned short slots = getSlotsNum();
+    if (index >= slots) return;
+    deallocate(index);
+    if (index == 0 || index == slots - 1) resetFence(key);
+}
+
+void DataBlock::resetFence(unsigned int key)
+{
+    unsigned short slots = getSlotsNum();
+    iovec field;
+    if (slots && getKey(0, key, field))
+        setLow(&field);
+    else
+        setLow(NULL);
+    if (slots && getKey(slots - 1, key, field))
+        setHigh(&field);
+    else
+        setHigh(NULL);
+}
+
+unsigned short DataBlock::search(
+    unsigned int key,
+    DataType *type,
+    const iovec &keyField,
+    bool &found)
+{
+    // 在[low, high)中找第一个不小于keyField的slot
+    unsigned short low = 0, high = getSlotsNum();
+    while (low < high) {
+        unsigned short mid = low + (high - low) / 2;
+        iovec field;
+        getKey(mid, key, field);
+        if (type->compare(
+                field.iov_base,
+                keyField.iov_base,
+                field.iov_len,
+                keyField.iov_len))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    found = false;
+    if (low < getSlotsNum()) {
+        iovec field;
+        getKey(low, key, field);
+        found = !type->compare(
+            keyField.iov_base, field.iov_base, keyField.iov_len, field.iov_len);
+    }
+    return low;
+}
+
 } // namespace db
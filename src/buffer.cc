@@ -0,0 +1,1074 @@
+////
+// @file buffer.cc
+// @brief
+// 实现缓冲池
+//
+// @author junix
+//
+#include <algorithm>
+#include <chrono>
+#include <db/buffer.h>
+#include <db/block.h>
+#include <db/endian.h>
+#include <db/replacer.h>
+
+namespace db {
+
+const size_t BufferPool::DEFAULT_CAPACITY;
+const unsigned int BufferPool::MAX_SHARDS;
+const size_t BufferPool::SHARD_FRAMES;
+const unsigned int BufferPool::DEFAULT_WRITER_INTERVAL;
+const unsigned int BufferPool::DEFAULT_CHECKPOINT_INTERVAL;
+const unsigned int BufferPool::DEFAULT_DIRTY_BACKGROUND;
+const unsigned int BufferPool::DEFAULT_DIRTY_LIMIT;
+const size_t BufferPool::MAX_WRITE_RUN;
+const unsigned int BufferPool::WARM_MAGIC_NUMBER;
+const size_t BufferPool::WARM_HEADER_SIZE;
+const size_t BufferPool::SHRINK_BATCH;
+
+// 不析构，其它静态对象析构时仍可以使用
+BufferPool &gbuffer = *new BufferPool();
+
+unsigned int blockSizeOf(const File *file)
+{
+    return file->blockSize_ ? file->blockSize_ : Block::BLOCK_SIZE;
+}
+
+// blockid在文件中的偏移量
+static inline unsigned long long offsetOf(const File *file, unsigned int blockid)
+{
+    if (blockid == 0) return 0;
+    return (unsigned long long) (blockid - 1) * blockSizeOf(file) +
+           Root::ROOT_SIZE;
+}
+
+// blockid的长度
+static inline size_t lengthOf(const File *file, unsigned int blockid)
+{
+    return blockid == 0 ? Root::ROOT_SIZE : blockSizeOf(file);
+}
+
+// 按(文件, blockid)排序
+static bool frameLess(const Frame *x, const Frame *y)
+{
+    if (x->fileid != y->fileid) return x->fileid < y->fileid;
+    return x->blockid < y->blockid;
+}
+
+// y在文件中紧接着x
+static inline bool adjacent(const Frame *x, const Frame *y)
+{
+    return x->fileid == y->fileid &&
+           offsetOf(x->file, x->blockid) + lengthOf(x->file, x->blockid) ==
+               offsetOf(y->file, y->blockid);
+}
+
+BufferPool::BufferPool(size_t capacity, int policy, unsigned int shards)
+    : capacity_(capacity ? capacity : 1)
+    , dirty_(0)
+    , background_(DEFAULT_DIRTY_BACKGROUND)
+    , limit_(DEFAULT_DIRTY_LIMIT)
+    , throttles_(0)
+    , checkpoints_(0)
+    , verify_(VERIFY_FIRST)
+    , sample_(DEFAULT_VERIFY_SAMPLE)
+    , verifies_(0)
+    , corruptions_(0)
+    , running_(false)
+    , stop_(false)
+    , interval_(DEFAULT_WRITER_INTERVAL)
+    , checkpoint_(DEFAULT_CHECKPOINT_INTERVAL)
+    , writerError_(S_OK)
+    , arena_(NULL)
+    , arenaSize_(0)
+    , arenaPages_(PAGES_NORMAL)
+{
+    if (shards == 0) {
+        // 每个分区至少SHARD_FRAMES个页面，分区数取2的幂
+        shards = 1;
+        while (shards * 2 <= MAX_SHARDS &&
+               capacity_ / (shards * 2) >= SHARD_FRAMES)
+            shards *= 2;
+    }
+    size_t each = (capacity_ + shards - 1) / shards;
+    for (unsigned int i = 0; i < shards; ++i) {
+        Shard *shard = new Shard;
+        shard->capacity = each;
+        shard->replacer = createReplacer(policy, each);
+        shards_.push_back(shard);
+    }
+}
+
+BufferPool::~BufferPool()
+{
+    stopWriter();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard *shard = shards_[i];
+        for (PageTable::iterator it = shard->table.begin();
+             it != shard->table.end();
+             ++it) {
+            if (!inArena(it->second->data)) alignedFree(it->second->data);
+            delete it->second;
+        }
+        for (std::list<Frame *>::iterator it = shard->free.begin();
+             it != shard->free.end();
+             ++it) {
+            if (!inArena((*it)->data)) alignedFree((*it)->data);
+            delete *it;
+        }
+        delete shard->replacer;
+        delete shard;
+    }
+    if (arena_) pageFree(arena_, arenaSize_, arenaPages_);
+}
+
+int BufferPool::pin(File *file, unsigned int blockid, Frame *&frame, int flags)
+{
+    Key key = {file->id_, blockid};
+    unsigned int index = shardOf(key);
+    Shard &shard = *shards_[index];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    Frame *fresh = NULL; // 换来的页面
+    for (;;) {
+        PageTable::iterator it = shard.table.find(key);
+        if (it != shard.table.end()) {
+            // 换出脏页时放过锁，其它线程可能已经读入，换来的页面不用了
+            if (fresh) shard.free.push_back(fresh);
+            frame = it->second;
+            ++frame->pins;
+            shard.replacer->touch(frame, flags);
+            ++shard.stats.hits;
+            lock.unlock();
+            // 其它线程正在读入，等它放掉写latch
+            if (frame->loading.load(std::memory_order_acquire)) {
+                frame->latch.lockShared();
+                frame->latch.unlockShared();
+            }
+            if (frame->error) {
+                int ret = frame->error;
+                unpin(frame);
+                return ret;
+            }
+            return (flags & PIN_FILL) ? S_FALSE : S_OK;
+        }
+        if (fresh) break;
+        int ret = grab(shard, lock, fresh, lengthOf(file, blockid));
+        if (ret) {
+            ++shard.stats.misses;
+            return ret;
+        }
+    }
+
+    ++shard.stats.misses;
+    frame = fresh;
+    int ret = S_OK;
+    // 先登记再读入，同一block的其它pin等待读入完成
+    assign(shard, index, file, blockid, frame, flags);
+    bool check = verifying(shard, file, blockid, flags);
+    lock.unlock();
+    // 调用者填写之后在filled中结束读入
+    if (flags & PIN_FILL) return S_OK;
+
+    size_t bytes = 0;
+    if (!(flags & PIN_NEW))
+        ret = file->read(
+            offsetOf(file, blockid),
+            (char *) frame->data,
+            lengthOf(file, blockid),
+            &bytes);
+    loaded(frame, ret, bytes, check);
+    ret = frame->error;
+    if (ret) unpin(frame);
+    return ret;
+}
+
+Frame *BufferPool::lookup(File *file, unsigned int blockid, int flags)
+{
+    Key key = {file->id_, blockid};
+    Shard &shard = *shards_[shardOf(key)];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    PageTable::iterator it = shard.table.find(key);
+    if (it == shard.table.end()) return NULL;
+    Frame *frame = it->second;
+    ++frame->pins;
+    shard.replacer->touch(frame, flags);
+    ++shard.stats.hits;
+    lock.unlock();
+    if (frame->loading.load(std::memory_order_acquire)) {
+        frame->latch.lockShared();
+        frame->latch.unlockShared();
+    }
+    if (frame->error) {
+        unpin(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+void BufferPool::unpin(Frame *frame)
+{
+    Shard &shard = *shards_[frame->shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (--frame->pins) return;
+    if (frame->error) {
+        discard(shard, frame);
+        return;
+    }
+    // 缩容时pin住的页面，现在按替换策略释放干净页面，脏页留给shrink
+    while (shard.count > shard.capacity) {
+        Frame *victim = shard.replacer->victim();
+        if (victim == NULL) break;
+        if (victim->dirty) {
+            shard.replacer->putBack(victim);
+            break;
+        }
+        Key key = {victim->fileid, victim->blockid};
+        shard.table.erase(key);
+        shard.verified.erase(key);
+        ++shard.stats.evictions;
+        release(shard, victim);
+    }
+}
+
+void BufferPool::markDirty(Frame *frame)
+{
+    if (!frame->dirty.exchange(true)) ++dirty_;
+}
+
+int BufferPool::flush(Frame *frame)
+{
+    if (!frame->dirty.load(std::memory_order_acquire)) return S_OK;
+    int ret = write(frame);
+    if (ret == S_OK) {
+        Shard &shard = *shards_[frame->shard];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ++shard.stats.writes;
+    }
+    return ret;
+}
+
+int BufferPool::flush(File *file)
+{
+    std::lock_guard<std::mutex> guard(cleanLock_);
+    return clean(0, file, NULL);
+}
+
+int BufferPool::drop(File *file)
+{
+    // 与写回线程互斥，返回后不会再有对file的写
+    std::lock_guard<std::mutex> guard(cleanLock_);
+    int result = clean(0, file, NULL);
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        PageTable::iterator it = shard.table.begin();
+        while (it != shard.table.end()) {
+            Frame *frame = it->second;
+            // pin住的页面还在使用，只写回
+            if (frame->fileid != file->id_ || frame->pins) {
+                ++it;
+                continue;
+            }
+            // 写回失败的页面也丢弃
+            if (frame->dirty.exchange(false)) --dirty_;
+            shard.replacer->remove(frame);
+            shard.free.push_back(frame);
+            shard.verified.erase(it->first);
+            it = shard.table.erase(it);
+        }
+    }
+    return result;
+}
+
+void BufferPool::resident(File *file, std::vector<unsigned int> &blocks)
+{
+    blocks.clear();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (PageTable::iterator it = shard.table.begin();
+             it != shard.table.end();
+             ++it) {
+            Frame *frame = it->second;
+            if (frame->fileid != file->id_ || frame->loading || frame->error)
+                continue;
+            blocks.push_back(frame->blockid);
+        }
+    }
+    std::sort(blocks.begin(), blocks.end());
+}
+
+int BufferPool::warm(
+    File *file,
+    const std::vector<unsigned int> &blocks,
+    size_t *count)
+{
+    // 只用空闲页面登记，不换出已缓存的页面
+    std::vector<Frame *> frames;
+    std::vector<char> checks;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        Key key = {file->id_, blocks[i]};
+        unsigned int index = shardOf(key);
+        Shard &shard = *shards_[index];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        if (shard.table.find(key) != shard.table.end()) continue;
+        if (shard.free.empty() ? shard.count >= shard.capacity
+                               : shard.count > shard.capacity)
+            continue;
+        Frame *frame;
+        if (grab(shard, lock, frame, lengthOf(file, blocks[i]))) continue;
+        // grab放过锁时其它线程可能已经读入
+        if (shard.table.find(key) != shard.table.end()) {
+            shard.free.push_back(frame);
+            continue;
+        }
+        ++shard.stats.misses;
+        assign(shard, index, file, blocks[i], frame, 0);
+        frames.push_back(frame);
+        checks.push_back(verifying(shard, file, blocks[i], 0));
+    }
+    if (count) *count = frames.size();
+    if (frames.empty()) return S_OK;
+
+    // 异步模式下一次提交全部读请求，并行完成；否则相邻的block合并为readv。
+    // 不改变文件的I/O模式
+    std::vector<IoRequest> reqs(frames.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+        reqs[i].opcode = IO_READ;
+        reqs[i].offset = offsetOf(file, frames[i]->blockid);
+        reqs[i].buffer = (char *) frames[i]->data;
+        reqs[i].length = lengthOf(file, frames[i]->blockid);
+    }
+    int ret = S_OK;
+    if (file->async())
+        ret = file->batch(&reqs[0], (int) reqs.size());
+    else {
+        std::vector<struct iovec> iov;
+        size_t i = 0;
+        while (i < reqs.size()) {
+            size_t end = i + 1;
+            while (end < reqs.size() && end - i < MAX_WRITE_RUN &&
+                   adjacent(frames[end - 1], frames[end]))
+                ++end;
+            iov.clear();
+            for (size_t j = i; j < end; ++j) {
+                struct iovec v;
+                v.iov_base = reqs[j].buffer;
+                v.iov_len = reqs[j].length;
+                iov.push_back(v);
+            }
+            size_t bytes = 0;
+            int err =
+                file->readv(reqs[i].offset, &iov[0], (int) iov.size(), &bytes);
+            // 读到文件尾时按顺序分给各个block，后面的读到0
+            for (size_t j = i; j < end; ++j) {
+                reqs[j].result = err;
+                reqs[j].bytes = bytes < reqs[j].length ? bytes : reqs[j].length;
+                bytes -= reqs[j].bytes;
+            }
+            i = end;
+        }
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+        // 提交失败时请求的状态不可信
+        int err = ret ? ret : reqs[i].result;
+        loaded(frames[i], err, reqs[i].bytes, checks[i] != 0);
+        unpin(frames[i]);
+    }
+    return ret;
+}
+
+int BufferPool::dump(File *file, const char *path)
+{
+    std::vector<unsigned int> blocks;
+    resident(file, blocks);
+    // 头部：magic、个数、checksum，之后是blockid
+    size_t length = WARM_HEADER_SIZE + blocks.size() * sizeof(unsigned int);
+    std::vector<unsigned char> buffer(length);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        unsigned int id = htobe32(blocks[i]);
+        ::memcpy(
+            &buffer[WARM_HEADER_SIZE + i * sizeof(unsigned int)],
+            &id,
+            sizeof(id));
+    }
+    unsigned int magic = htobe32(WARM_MAGIC_NUMBER);
+    unsigned int cnt = htobe32((unsigned int) blocks.size());
+    unsigned int check = htobe32(checksum32(
+        &buffer[0] + WARM_HEADER_SIZE, (int) (length - WARM_HEADER_SIZE)));
+    ::memcpy(&buffer[0], &magic, sizeof(magic));
+    ::memcpy(&buffer[4], &cnt, sizeof(cnt));
+    ::memcpy(&buffer[8], &check, sizeof(check));
+
+    // 截断后重写，新列表比旧的短时不留下尾部
+    File out;
+    int ret = out.open(path, OPEN_TRUNCATE);
+    if (ret) return ret;
+    ret = out.write(0, (const char *) &buffer[0], length);
+    if (ret == S_OK) ret = out.sync();
+    out.close();
+    return ret;
+}
+
+int BufferPool::restore(File *file, const char *path, size_t *count)
+{
+    if (count) *count = 0;
+    // 只打开已有的列表，不存在时不创建
+    File in;
+    int ret = in.open(path, OPEN_NOCREATE);
+    if (ret) return ret == ENOENT ? S_FALSE : ret;
+    unsigned long long length;
+    ret = in.length(length);
+    if (ret || length < WARM_HEADER_SIZE) {
+        in.close();
+        return ret ? ret : S_FALSE;
+    }
+    std::vector<unsigned char> buffer((size_t) length);
+    ret = in.read(0, (char *) &buffer[0], (size_t) length);
+    in.close();
+    if (ret) return ret;
+
+    // 检查magic、长度和checksum，不对的列表忽略
+    unsigned int magic, cnt, check;
+    ::memcpy(&magic, &buffer[0], sizeof(magic));
+    ::memcpy(&cnt, &buffer[4], sizeof(cnt));
+    ::memcpy(&check, &buffer[8], sizeof(check));
+    cnt = be32toh(cnt);
+    check = be32toh(check);
+    if (be32toh(magic) != WARM_MAGIC_NUMBER ||
+        cnt > (length - WARM_HEADER_SIZE) / sizeof(unsigned int))
+        return S_FALSE;
+    size_t body = cnt * sizeof(unsigned int);
+    if (checksum32(&buffer[0] + WARM_HEADER_SIZE, (int) body) != check)
+        return S_FALSE;
+    std::vector<unsigned int> blocks(cnt);
+    for (unsigned int i = 0; i < cnt; ++i) {
+        unsigned int id;
+        ::memcpy(
+            &id, &buffer[WARM_HEADER_SIZE + i * sizeof(unsigned int)], sizeof(id));
+        blocks[i] = be32toh(id);
+    }
+    return warm(file, blocks, count);
+}
+
+bool BufferPool::cached(File *file, unsigned int blockid)
+{
+    Key key = {file->id_, blockid};
+    Shard &shard = *shards_[shardOf(key)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.table.find(key) != shard.table.end();
+}
+
+int BufferPool::startWriter(unsigned int interval, unsigned int checkpoint)
+{
+    std::lock_guard<std::mutex> lock(writerLock_);
+    if (running_) return EEXIST;
+    interval_ = interval ? interval : 1;
+    checkpoint_ = checkpoint;
+    stop_ = false;
+    writerError_ = S_OK;
+    writer_ = std::thread(&BufferPool::run, this);
+    running_ = true;
+    return S_OK;
+}
+
+void BufferPool::stopWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(writerLock_);
+        if (!running_) return;
+        stop_ = true;
+    }
+    wake_.notify_all();
+    writer_.join();
+    {
+        std::lock_guard<std::mutex> lock(writerLock_);
+        running_ = false;
+    }
+    // 等待中的修改者改为自己写回
+    done_.notify_all();
+}
+
+bool BufferPool::writerRunning()
+{
+    std::lock_guard<std::mutex> lock(writerLock_);
+    return running_;
+}
+
+int BufferPool::setVerify(int policy, unsigned int sample)
+{
+    if (policy < VERIFY_OFF || policy > VERIFY_SAMPLED || sample == 0)
+        return EINVAL;
+    sample_ = sample;
+    verify_ = policy;
+    return S_OK;
+}
+
+int BufferPool::filled(Frame *frame, int ret, size_t bytes, int flags)
+{
+    Shard &shard = *shards_[frame->shard];
+    bool check;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        check = verifying(shard, frame->file, frame->blockid, flags);
+    }
+    loaded(frame, ret, bytes, check);
+    return frame->error;
+}
+
+int BufferPool::setDirtyRatio(unsigned int background, unsigned int limit)
+{
+    if (background > limit || limit > 100) return EINVAL;
+    background_ = background;
+    limit_ = limit;
+    return S_OK;
+}
+
+int BufferPool::throttle()
+{
+    size_t limit = ratioOf(limit_);
+    if (dirty_.load() <= limit) return S_OK;
+    ++throttles_;
+    std::unique_lock<std::mutex> lock(writerLock_);
+    while (running_ && dirty_.load() > limit) {
+        // 唤醒写回线程，等它写完一轮
+        wake_.notify_one();
+        done_.wait(lock);
+        if (writerError_) return writerError_;
+    }
+    if (dirty_.load() <= limit) return S_OK;
+    lock.unlock();
+
+    // 没有写回线程，自己写回到后台比例
+    std::lock_guard<std::mutex> guard(cleanLock_);
+    return clean(ratioOf(background_), NULL, NULL);
+}
+
+int BufferPool::checkpoint(File *file)
+{
+    std::lock_guard<std::mutex> guard(cleanLock_);
+    return sync(file);
+}
+
+int BufferPool::checkpoint()
+{
+    std::lock_guard<std::mutex> guard(cleanLock_);
+    // 收集有脏页的文件，drop与此互斥，文件在此期间不会关闭
+    std::vector<File *> files;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (PageTable::iterator it = shard.table.begin();
+             it != shard.table.end();
+             ++it) {
+            Frame *frame = it->second;
+            if (!frame->dirty || frame->loading || frame->error) continue;
+            if (std::find(files.begin(), files.end(), frame->file) ==
+                files.end())
+                files.push_back(frame->file);
+        }
+    }
+    int result = S_OK;
+    for (size_t i = 0; i < files.size(); ++i) {
+        int ret = sync(files[i]);
+        if (ret) result = ret;
+    }
+    return result;
+}
+
+int BufferPool::setArena(bool huge)
+{
+    // 先锁住所有分区，确认还没有分配页面
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        locks.push_back(std::unique_lock<std::mutex>(shards_[i]->mutex));
+        if (shards_[i]->count) return EBUSY;
+    }
+    if (arena_) return EBUSY;
+
+    // 每个分区按容量切出连续的一段，扩容之后多出的页面仍逐个分配
+    size_t each = shards_[0]->capacity;
+    size_t size = each * shards_.size() * Block::BLOCK_SIZE;
+    int pages;
+    unsigned char *arena = (unsigned char *) pageAlloc(size, huge, pages);
+    if (arena == NULL) return ENOMEM;
+    arena_ = arena;
+    arenaSize_ = size;
+    arenaPages_ = pages;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        shards_[i]->arena = arena + i * each * Block::BLOCK_SIZE;
+        shards_[i]->slots = each;
+    }
+    return S_OK;
+}
+
+int BufferPool::arena()
+{
+    std::lock_guard<std::mutex> lock(shards_[0]->mutex);
+    return arena_ ? arenaPages_ : -1;
+}
+
+int BufferPool::setCapacity(size_t capacity)
+{
+    capacity_ = capacity ? capacity : 1;
+    size_t each = (capacity_ + shards_.size() - 1) / shards_.size();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.capacity = each;
+        shard.replacer->resize(each);
+    }
+    // 先全部设定上限，之后的分配不再增长，再逐个分区释放
+    int result = S_OK;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        int ret = shrink(*shards_[i]);
+        if (ret) result = ret;
+    }
+    return result;
+}
+
+void BufferPool::setPolicy(int policy)
+{
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.replacer->type() == policy) continue;
+        // 按原策略的换出顺序取出，再依次加入新策略
+        std::vector<Frame *> frames;
+        std::vector<Frame *> pinned;
+        frames.reserve(shard.table.size());
+        for (;;) {
+            Frame *frame = shard.replacer->victim();
+            if (frame == NULL) break;
+            frames.push_back(frame);
+        }
+        for (PageTable::iterator it = shard.table.begin();
+             it != shard.table.end();
+             ++it)
+            if (it->second->pins) {
+                shard.replacer->remove(it->second);
+                pinned.push_back(it->second);
+            }
+        delete shard.replacer;
+        shard.replacer = createReplacer(policy, shard.capacity);
+        for (size_t j = 0; j < frames.size(); ++j)
+            shard.replacer->admit(frames[j], 0);
+        for (size_t j = 0; j < pinned.size(); ++j)
+            shard.replacer->admit(pinned[j], 0);
+    }
+}
+
+int BufferPool::policy()
+{
+    Shard &shard = *shards_[0];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.replacer->type();
+}
+
+size_t BufferPool::capacity() { return capacity_; }
+
+size_t BufferPool::size()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+        count += shards_[i]->count;
+    }
+    return count;
+}
+
+BufferStats BufferPool::stats()
+{
+    BufferStats stats;
+    stats.throttles = throttles_;
+    stats.checkpoints = checkpoints_;
+    stats.verifies = verifies_;
+    stats.corruptions = corruptions_;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+        const BufferStats &s = shards_[i]->stats;
+        stats.hits += s.hits;
+        stats.misses += s.misses;
+        stats.evictions += s.evictions;
+        stats.writes += s.writes;
+    }
+    return stats;
+}
+
+int BufferPool::grab(
+    Shard &shard,
+    std::unique_lock<std::mutex> &lock,
+    Frame *&frame,
+    size_t length)
+{
+    for (;;) {
+        // 缩容后多出的空闲页面直接释放
+        while (shard.count > shard.capacity && !shard.free.empty()) {
+            release(shard, shard.free.front());
+            shard.free.pop_front();
+        }
+        if (!shard.free.empty()) {
+            frame = shard.free.front();
+            shard.free.pop_front();
+            break;
+        }
+        if (shard.count < shard.capacity) {
+            // 先用区域中释放过的位置，再用没用过的，区域用完后逐个分配；
+            // 页面至少为缺省block大小，更大的block单独分配
+            unsigned char *data;
+            size_t size = Block::BLOCK_SIZE;
+            if (length > size) {
+                size = length;
+                data = (unsigned char *) alignedAlloc(size);
+            } else if (!shard.spare.empty()) {
+                data = shard.spare.back();
+                shard.spare.pop_back();
+            } else if (shard.used < shard.slots)
+                data = shard.arena + shard.used++ * Block::BLOCK_SIZE;
+            else
+                data = (unsigned char *) alignedAlloc(size);
+            if (data == NULL) return ENOMEM;
+            frame = new Frame;
+            frame->data = data;
+            frame->size = size;
+            ++shard.count;
+            return S_OK;
+        }
+
+        // 按替换策略换出干净页面
+        frame = shard.replacer->victim();
+        if (frame == NULL) return ENOMEM;
+        if (!frame->dirty) {
+            Key key = {frame->fileid, frame->blockid};
+            shard.table.erase(key);
+            shard.verified.erase(key);
+            ++shard.stats.evictions;
+            break;
+        }
+        // 脏页与shrink一样pin住放回替换器，放锁后写回，与drop互斥，文件不会
+        // 在写回期间关闭；重新持锁后分区可能已经变化，从头再选
+        ++frame->pins;
+        shard.replacer->putBack(frame);
+        lock.unlock();
+        int ret;
+        {
+            std::lock_guard<std::mutex> guard(cleanLock_);
+            ret = flush(frame);
+        }
+        lock.lock();
+        --frame->pins;
+        if (ret) return ret;
+    }
+
+    // 重用的页面比block小时换成足够大的buffer
+    if (frame->size < length) {
+        unsigned char *data = (unsigned char *) alignedAlloc(length);
+        if (data == NULL) {
+            shard.free.push_back(frame);
+            return ENOMEM;
+        }
+        if (inArena(frame->data))
+            shard.spare.push_back(frame->data);
+        else
+            alignedFree(frame->data);
+        frame->data = data;
+        frame->size = length;
+    }
+    return S_OK;
+}
+
+void BufferPool::assign(
+    Shard &shard,
+    unsigned int index,
+    File *file,
+    unsigned int blockid,
+    Frame *frame,
+    int flags)
+{
+    frame->file = file;
+    frame->fileid = file->id_;
+    frame->blockid = blockid;
+    frame->shard = index;
+    frame->pins = 1;
+    frame->dirty = false;
+    frame->error = S_OK;
+    frame->latch.lock();
+    frame->loading.store(true, std::memory_order_relaxed);
+    Key key = {file->id_, blockid};
+    shard.table[key] = frame;
+    shard.replacer->admit(frame, flags);
+}
+
+bool BufferPool::verifying(
+    Shard &shard,
+    File *file,
+    unsigned int blockid,
+    int flags)
+{
+    int policy = verify_.load(std::memory_order_relaxed);
+    if (policy == VERIFY_OFF || file->algorithm_ < 0 || blockid == 0 ||
+        (flags & (PIN_NEW | PIN_NOVERIFY | PIN_FILL)))
+        return false;
+    if (policy == VERIFY_FIRST) {
+        Key key = {file->id_, blockid};
+        return shard.verified.insert(key).second;
+    }
+    if (policy == VERIFY_SAMPLED) return ++shard.loads % sample_.load() == 0;
+    return true;
+}
+
+int BufferPool::verify(Frame *frame)
+{
+    Block block(
+        frame->data,
+        blockSizeOf(frame->file),
+        frame->file->algorithm_);
+    // 空闲block可能打过洞，尾部的checksum已不在
+    if (block.getType() == BLOCK_TYPE_FREE) return S_OK;
+    ++verifies_;
+    if (block.checksum()) return S_OK;
+    ++corruptions_;
+    // 下次读入时重新检验
+    Shard &shard = *shards_[frame->shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Key key = {frame->fileid, frame->blockid};
+    shard.verified.erase(key);
+    return EIO;
+}
+
+void BufferPool::loaded(Frame *frame, int ret, size_t bytes, bool check)
+{
+    // 文件尾之后读到0，没有写过的block不检验
+    size_t length = lengthOf(frame->file, frame->blockid);
+    if (ret == S_OK && bytes < length)
+        ::memset(frame->data + bytes, 0, length - bytes);
+    if (ret == S_OK && check && bytes) ret = verify(frame);
+    frame->error = ret;
+    frame->loading.store(false, std::memory_order_release);
+    frame->latch.unlock();
+}
+
+void BufferPool::release(Shard &shard, Frame *frame)
+{
+    if (inArena(frame->data)) {
+        // 区域中的位置留给之后的分配，内存先还给系统
+        pageDiscard(frame->data, Block::BLOCK_SIZE);
+        shard.spare.push_back(frame->data);
+    } else
+        alignedFree(frame->data);
+    delete frame;
+    --shard.count;
+}
+
+int BufferPool::shrink(Shard &shard)
+{
+    for (;;) {
+        // 与写回线程、drop互斥，锁外写回的脏页不会被drop漏掉
+        std::lock_guard<std::mutex> guard(cleanLock_);
+        std::vector<Frame *> dirty;
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        size_t released = 0;
+        while (shard.count > shard.capacity && !shard.free.empty() &&
+               released < SHRINK_BATCH) {
+            release(shard, shard.free.front());
+            shard.free.pop_front();
+            ++released;
+        }
+        while (shard.count - dirty.size() > shard.capacity &&
+               released + dirty.size() < SHRINK_BATCH) {
+            Frame *frame = shard.replacer->victim();
+            if (frame == NULL) break;
+            if (frame->dirty) {
+                // pin住放回替换器，锁外写回后再释放
+                ++frame->pins;
+                shard.replacer->putBack(frame);
+                dirty.push_back(frame);
+                continue;
+            }
+            Key key = {frame->fileid, frame->blockid};
+            shard.table.erase(key);
+            shard.verified.erase(key);
+            ++shard.stats.evictions;
+            release(shard, frame);
+            ++released;
+        }
+        // 已不超过容量，或剩下的页面都被pin住，等unpin时释放
+        if (dirty.empty() &&
+            (shard.count <= shard.capacity || released == 0))
+            return S_OK;
+        lock.unlock();
+
+        int result = S_OK;
+        for (size_t i = 0; i < dirty.size(); ++i) {
+            int ret = flush(dirty[i]);
+            if (ret) result = ret;
+            // 写回后干净，unpin时按超出的数目释放
+            unpin(dirty[i]);
+        }
+        if (result) return result;
+    }
+}
+
+void BufferPool::discard(Shard &shard, Frame *frame)
+{
+    Key key = {frame->fileid, frame->blockid};
+    shard.table.erase(key);
+    shard.verified.erase(key);
+    shard.replacer->remove(frame);
+    frame->error = S_OK;
+    shard.free.push_back(frame);
+}
+
+int BufferPool::write(Frame *frame)
+{
+    // 持读latch后清脏标志，之后的修改会再次标脏
+    frame->latch.lockShared();
+    if (frame->dirty.exchange(false)) --dirty_;
+    int ret = frame->file->write(
+        offsetOf(frame->file, frame->blockid),
+        (const char *) frame->data,
+        lengthOf(frame->file, frame->blockid));
+    frame->latch.unlockShared();
+    if (ret && !frame->dirty.exchange(true)) ++dirty_;
+    return ret;
+}
+
+int BufferPool::clean(size_t target, File *file, size_t *written)
+{
+    if (written) *written = 0;
+    if (dirty_.load() <= target) return S_OK;
+    // 持锁时只收集并pin住，写在锁外进行
+    std::vector<Frame *> frames;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard &shard = *shards_[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (PageTable::iterator it = shard.table.begin();
+             it != shard.table.end();
+             ++it) {
+            Frame *frame = it->second;
+            if (file && frame->fileid != file->id_) continue;
+            if (!frame->dirty || frame->loading || frame->error) continue;
+            ++frame->pins;
+            frames.push_back(frame);
+        }
+    }
+    std::sort(frames.begin(), frames.end(), frameLess);
+
+    int result = S_OK;
+    std::vector<struct iovec> iov;
+    std::vector<IoRequest> reqs;
+    size_t i = 0;
+    while (i < frames.size() && dirty_.load() > target) {
+        // 第一个页面等待latch，之后的页面只尝试，不同时等待多个latch；
+        // 异步模式下同一文件的脏页不必相邻，一次提交，否则相邻的合并为writev
+        File *file = frames[i]->file;
+        bool async = file->async();
+        size_t end = i + 1;
+        frames[i]->latch.lockShared();
+        while (end < frames.size() && end - i < MAX_WRITE_RUN &&
+               (async ? frames[end]->file == file
+                      : adjacent(frames[end - 1], frames[end])) &&
+               frames[end]->latch.tryLockShared())
+            ++end;
+        iov.clear();
+        reqs.clear();
+        for (size_t j = i; j < end; ++j) {
+            if (frames[j]->dirty.exchange(false)) --dirty_;
+            struct iovec v;
+            v.iov_base = frames[j]->data;
+            v.iov_len = lengthOf(file, frames[j]->blockid);
+            iov.push_back(v);
+            IoRequest req;
+            req.opcode = IO_WRITE;
+            req.offset = offsetOf(file, frames[j]->blockid);
+            req.buffer = (char *) v.iov_base;
+            req.length = v.iov_len;
+            reqs.push_back(req);
+        }
+        // 批量写有一个失败时全部重新标脏，重写是无害的
+        int ret = async ? file->batch(&reqs[0], (int) reqs.size())
+                        : file->writev(
+                              offsetOf(file, frames[i]->blockid),
+                              &iov[0],
+                              (int) iov.size());
+        for (size_t j = i; j < end; ++j) {
+            frames[j]->latch.unlockShared();
+            if (ret) {
+                if (!frames[j]->dirty.exchange(true)) ++dirty_;
+                continue;
+            }
+            Shard &shard = *shards_[frames[j]->shard];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            ++shard.stats.writes;
+        }
+        if (ret)
+            result = ret;
+        else if (written)
+            *written += end - i;
+        i = end;
+    }
+    for (size_t j = 0; j < frames.size(); ++j)
+        unpin(frames[j]);
+    return result;
+}
+
+int BufferPool::sync(File *file)
+{
+    size_t written;
+    int ret = clean(0, file, &written);
+    if (ret || written == 0) return ret;
+    // 数据落盘之后，在root中记下检查点时戳
+    ret = file->sync();
+    if (ret) return ret;
+    Frame *root = lookup(file, 0);
+    if (root) {
+        root->latch.lock();
+        Root r;
+        r.attach(root->data);
+        TimeStamp ts;
+        ts.now();
+        r.setTimeStamp(ts);
+        r.setChecksum();
+        root->latch.unlock();
+        markDirty(root);
+        ret = flush(root);
+        unpin(root);
+        if (ret) return ret;
+        ret = file->sync();
+        if (ret) return ret;
+    }
+    ++checkpoints_;
+    return S_OK;
+}
+
+void BufferPool::run()
+{
+    std::chrono::steady_clock::time_point last =
+        std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(writerLock_);
+    while (!stop_) {
+        wake_.wait_for(lock, std::chrono::milliseconds(interval_));
+        if (stop_) break;
+        unsigned int period = checkpoint_;
+        lock.unlock();
+
+        int ret = S_OK;
+        {
+            std::lock_guard<std::mutex> guard(cleanLock_);
+            ret = clean(ratioOf(background_), NULL, NULL);
+        }
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        if (period && now - last >= std::chrono::milliseconds(period)) {
+            int err = checkpoint();
+            if (ret == S_OK) ret = err;
+            last = now;
+        }
+
+        lock.lock();
+        writerError_ = ret;
+        done_.notify_all();
+    }
+}
+
+} // namespace db
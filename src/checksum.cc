@@ -0,0 +1,261 @@
+////
+// @file checksum.cc
+// @brief
+// 实现向量化的32位和、CRC32C
+//
+// @author junix
+//
+#include <db/checksum.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    include <immintrin.h>
+#    define CRC32C_SSE42
+#    define CHECKSUM_SIMD
+#endif
+
+namespace db {
+
+namespace {
+
+// 大端32位字之和的低32位，len为4的倍数
+unsigned int sum32Scalar(const unsigned char *buf, size_t len)
+{
+    unsigned int sum = 0;
+    for (; len >= 4; buf += 4, len -= 4)
+        sum += (unsigned int) buf[0] << 24 | (unsigned int) buf[1] << 16 |
+               (unsigned int) buf[2] << 8 | (unsigned int) buf[3];
+    return sum;
+}
+
+#if defined(CHECKSUM_SIMD)
+// 每次16B，32位字先转为主机序再按32位累加，溢出自然回绕
+__attribute__((target("sse2"))) unsigned int
+sum32Sse2(const unsigned char *buf, size_t len)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (buf + i + 16));
+        // 交换16位内的两个字节，再交换32位内的两个16位
+        v0 = _mm_or_si128(_mm_slli_epi16(v0, 8), _mm_srli_epi16(v0, 8));
+        v1 = _mm_or_si128(_mm_slli_epi16(v1, 8), _mm_srli_epi16(v1, 8));
+        v0 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v0, 0xb1), 0xb1);
+        v1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v1, 0xb1), 0xb1);
+        acc0 = _mm_add_epi32(acc0, v0);
+        acc1 = _mm_add_epi32(acc1, v1);
+    }
+    unsigned int lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, _mm_add_epi32(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           sum32Scalar(buf + i, len - i);
+}
+
+// 每次32B，用字节重排转为主机序
+__attribute__((target("avx2"))) unsigned int
+sum32Avx2(const unsigned char *buf, size_t len)
+{
+    const __m256i swap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+        acc0 = _mm256_add_epi32(acc0, _mm256_shuffle_epi8(v0, swap));
+        acc1 = _mm256_add_epi32(acc1, _mm256_shuffle_epi8(v1, swap));
+    }
+    unsigned int lanes[8];
+    _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi32(acc0, acc1));
+    unsigned int sum = 0;
+    for (int k = 0; k < 8; ++k)
+        sum += lanes[k];
+    return sum + sum32Scalar(buf + i, len - i);
+}
+#endif
+
+typedef unsigned int (*Sum32Func)(const unsigned char *, size_t);
+
+// 指令集对应的实现，CPU不支持时退回标量实现
+Sum32Func sum32Of(int simd)
+{
+#if defined(CHECKSUM_SIMD)
+    __builtin_cpu_init();
+    if (simd >= SIMD_AVX2 && __builtin_cpu_supports("avx2")) return sum32Avx2;
+    if (simd >= SIMD_SSE2 && __builtin_cpu_supports("sse2")) return sum32Sse2;
+#endif
+    return sum32Scalar;
+}
+
+Sum32Func sum32Func()
+{
+    static Sum32Func func = sum32Of(SIMD_AVX2);
+    return func;
+}
+
+// 按sum32累加整字，尾部同checksum32Scalar
+unsigned int checksum32By(Sum32Func func, const unsigned char *buf, int len)
+{
+    if (len < 0) return checksum32Scalar(buf, len);
+    size_t bulk = (size_t) len & ~(size_t) 3;
+    unsigned int sum = func(buf, bulk);
+    buf += bulk;
+    len -= (int) bulk;
+    // clang-format off
+    if (len) { sum += (unsigned int) (*buf++) << 24; --len;
+        if (len) { sum += (unsigned int) (*buf++) << 16; --len;
+            if (len) { sum += (unsigned int) (*buf++) << 8; --len; } } }
+    // clang-format on
+    return htonl(~sum + 1);
+}
+
+const unsigned int CRC32C_POLY = 0x82f63b78; // 反射的Castagnoli多项式
+
+// slicing-by-8的查表，t[k][i]为字节i后面跟k个0字节的余数
+struct Crc32cTable
+{
+    unsigned int t[8][256];
+
+    Crc32cTable()
+    {
+        for (unsigned int i = 0; i < 256; ++i) {
+            unsigned int crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+        for (unsigned int i = 0; i < 256; ++i)
+            for (int k = 1; k < 8; ++k)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+    }
+};
+
+const Crc32cTable &crc32cTable()
+{
+    static Crc32cTable table;
+    return table;
+}
+
+// 按小端取4B，与主机字节序无关
+inline unsigned int load32(const unsigned char *p)
+{
+    return (unsigned int) p[0] | (unsigned int) p[1] << 8 |
+           (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+// 查表实现，crc为取反后的中间值
+unsigned int
+crc32cSlicing(const unsigned char *buf, size_t len, unsigned int crc)
+{
+    const Crc32cTable &table = crc32cTable();
+    const unsigned int(*t)[256] = table.t;
+    while (len && ((size_t) buf & 7)) {
+        crc = t[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        --len;
+    }
+    // 每次8B
+    while (len >= 8) {
+        unsigned int lo = crc ^ load32(buf);
+        unsigned int hi = load32(buf + 4);
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+              t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^ t[3][hi & 0xff] ^
+              t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^
+              t[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = t[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(CRC32C_SSE42)
+// crc32指令实现，crc为取反后的中间值
+__attribute__((target("sse4.2"))) unsigned int
+crc32cSse42(const unsigned char *buf, size_t len, unsigned int crc)
+{
+    while (len && ((size_t) buf & 7)) {
+        crc = _mm_crc32_u8(crc, *buf++);
+        --len;
+    }
+#    if defined(__x86_64__)
+    unsigned long long crc64 = crc;
+    while (len >= 8) {
+        unsigned long long v;
+        ::memcpy(&v, buf, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        buf += 8;
+        len -= 8;
+    }
+    crc = (unsigned int) crc64;
+#    endif
+    while (len >= 4) {
+        unsigned int v;
+        ::memcpy(&v, buf, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+        buf += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc = _mm_crc32_u8(crc, *buf++);
+    return crc;
+}
+#endif
+
+typedef unsigned int (*Crc32cFunc)(const unsigned char *, size_t, unsigned int);
+
+// 按CPU选择实现
+Crc32cFunc selectCrc32c()
+{
+#if defined(CRC32C_SSE42)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) return crc32cSse42;
+#endif
+    return crc32cSlicing;
+}
+
+Crc32cFunc crc32cFunc()
+{
+    static Crc32cFunc func = selectCrc32c();
+    return func;
+}
+
+} // namespace
+
+unsigned int checksum32(const unsigned char *buf, int len)
+{
+    return checksum32By(sum32Func(), buf, len);
+}
+
+unsigned int checksum32With(int simd, const unsigned char *buf, int len)
+{
+    return checksum32By(sum32Of(simd), buf, len);
+}
+
+int checksum32Simd()
+{
+    Sum32Func func = sum32Func();
+#if defined(CHECKSUM_SIMD)
+    if (func == sum32Avx2) return SIMD_AVX2;
+    if (func == sum32Sse2) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+unsigned int crc32c(const unsigned char *buf, size_t len, unsigned int crc)
+{
+    return ~crc32cFunc()(buf, len, ~crc);
+}
+
+unsigned int
+crc32cSoftware(const unsigned char *buf, size_t len, unsigned int crc)
+{
+    return ~crc32cSlicing(buf, len, ~crc);
+}
+
+bool crc32cHardware() { return crc32cFunc() != crc32cSlicing; }
+
+} // namespace db
@@ -0,0 +1,83 @@
+////
+// @file commit.cc
+// @brief
+// 实现组提交
+//
+// @author junix
+//
+#include <chrono>
+#include <db/commit.h>
+
+namespace db {
+
+int Committer::commit()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++stats_.commits;
+
+    // 每次提交都刷盘
+    if (level_ != DURABILITY_GROUP) {
+        lock.unlock();
+        int ret = file_->sync();
+        lock.lock();
+        ++stats_.flushes;
+        stats_.lastBatch = 1;
+        if (stats_.maxBatch < 1) stats_.maxBatch = 1;
+        return ret;
+    }
+
+    // 加入当前组
+    unsigned long long group = group_;
+    ++pending_;
+
+    if (leader_) {
+        // 跟随者：凑满则提前唤醒leader，然后等待本组刷盘，只取本组的结果
+        if (pending_ >= count_) full_.notify_one();
+        Generation &gen = waiting_[group];
+        ++gen.waiters;
+        while (!gen.done)
+            done_.wait(lock);
+        int ret = gen.result;
+        if (--gen.waiters == 0) waiting_.erase(group);
+        return ret;
+    }
+
+    // leader：等待窗口结束或凑满
+    leader_ = true;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(window_);
+    while (pending_ < count_ &&
+           full_.wait_until(lock, deadline) != std::cv_status::timeout)
+        ;
+
+    // 关闭本组，之后到达的提交者进入下一组
+    unsigned int batch = pending_;
+    pending_ = 0;
+    leader_ = false;
+    ++group_;
+
+    lock.unlock();
+    int ret = file_->sync();
+    lock.lock();
+
+    // 本组的跟随者在关闭之前都已登记
+    std::map<unsigned long long, Generation>::iterator it =
+        waiting_.find(group);
+    if (it != waiting_.end()) {
+        it->second.done = true;
+        it->second.result = ret;
+    }
+    ++stats_.flushes;
+    stats_.lastBatch = batch;
+    if (stats_.maxBatch < batch) stats_.maxBatch = batch;
+    done_.notify_all();
+    return ret;
+}
+
+SyncStats Committer::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace db
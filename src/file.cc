@@ -6,38 +6,164 @@
 // @author niexw
 // @email niexiaowen@uestc.edu.cn
 //
+#include <atomic>
 #include <db/file.h>
+#include <db/aio.h>
+#include <db/commit.h>
+#include <db/segment.h>
+#if !defined(WIN32)
+#    include <vector>
+#    include <errno.h>
+#    include <limits.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#endif
 
 namespace db {
 
-int File::open(const char *path)
+// 每次打开分配新的序号，缓冲池以此区分先后打开的文件
+static unsigned long long nextId()
 {
+    static std::atomic<unsigned long long> id(0);
+    return ++id;
+}
+
+// 内存段上的分散读、聚集写，逐段进行
+static int memoryv(
+    File *file,
+    int opcode,
+    unsigned long long offset,
+    const struct iovec *iov,
+    int iovcnt,
+    size_t *bytes)
+{
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t n;
+        int ret = opcode == IO_READ
+                      ? file->segment_->read(
+                            offset + done, (char *) iov[i].iov_base,
+                            iov[i].iov_len, &n)
+                      : file->segment_->write(
+                            offset + done, (const char *) iov[i].iov_base,
+                            iov[i].iov_len, &n);
+        done += n;
+        if (ret || n < iov[i].iov_len) {
+            if (bytes) *bytes = done;
+            return ret;
+        }
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+// 映射期间文件只读，写会使视图失效（内存段重新分配）或与之不一致
+static inline int readOnly(size_t *bytes)
+{
+    if (bytes) *bytes = 0;
+    return EROFS;
+}
+
+// 内存段直接作为映射视图
+static int mapMemory(File *file)
+{
+    unsigned long long len = file->segment_->length();
+    if (len == 0) return EINVAL;
+    file->map_ = file->segment_->map();
+    file->mapSize_ = len;
+    return S_OK;
+}
+
+#if defined(WIN32)
+
+void *alignedAlloc(size_t size)
+{
+    return ::_aligned_malloc(size, File::IO_ALIGNMENT);
+}
+
+void alignedFree(void *buffer) { ::_aligned_free(buffer); }
+
+void *pageAlloc(size_t size, bool huge, int &pages)
+{
+    // 大页需要SeLockMemoryPrivilege，这里只用普通页
+    pages = PAGES_NORMAL;
+    return ::_aligned_malloc(size, File::IO_ALIGNMENT);
+}
+
+void pageFree(void *buffer, size_t size, int pages) { ::_aligned_free(buffer); }
+
+void pageDiscard(void *buffer, size_t size)
+{
+    // _aligned_malloc的内存不能部分归还，留到整体释放
+}
+
+int File::open(const char *path, int mode)
+{
+    id_ = nextId();
+    // 内存段，不涉及文件系统
+    if (mode & OPEN_MEMORY) {
+        segment_ = Segment::attach(path);
+        return S_OK;
+    }
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-createfilea
     // TODO:
     // 1. path修改成unicode，CreateFile
     // 2. buffer、overlap？
     //
+    DWORD flags = FILE_ATTRIBUTE_NORMAL; // 普通文件
+    if (mode & OPEN_DIRECT)
+        flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+    // 缺省打开已有文件，不存在文件则创建
+    DWORD disposition = OPEN_ALWAYS;
+    if (mode & OPEN_NOCREATE)
+        disposition =
+            (mode & OPEN_TRUNCATE) ? TRUNCATE_EXISTING : OPEN_EXISTING;
+    else if (mode & OPEN_TRUNCATE)
+        disposition = CREATE_ALWAYS;
     handle_ = ::CreateFileA(
         path,                               // 路径
         GENERIC_READ | GENERIC_WRITE,       // 访问权限
         FILE_SHARE_READ | FILE_SHARE_WRITE, // 与其它进程共享读写
         NULL,                               // 安全属性
-        OPEN_ALWAYS,           // 打开已有文件，不存在文件则创建
-        FILE_ATTRIBUTE_NORMAL, // 普通文件
+        disposition,
+        flags,
         NULL);
-    return handle_ == INVALID_HANDLE_VALUE ? ::GetLastError() : S_OK;
+    if (handle_ != INVALID_HANDLE_VALUE) return S_OK;
+    DWORD err = ::GetLastError();
+    // 与POSIX一致，文件不存在返回ENOENT
+    return err == ERROR_FILE_NOT_FOUND ? ENOENT : (int) err;
 }
 
 void File::close()
 {
+    if (engine_) {
+        delete engine_;
+        engine_ = NULL;
+    }
+    if (committer_) {
+        delete committer_;
+        committer_ = NULL;
+    }
+    unmap();
     if (handle_ != INVALID_HANDLE_VALUE) {
         ::CloseHandle(handle_);
         handle_ = INVALID_HANDLE_VALUE;
     }
+    if (segment_) {
+        Segment::detach(segment_);
+        segment_ = NULL;
+    }
 }
 
-int File::read(unsigned long long offset, char *buffer, size_t length)
+int File::read(
+    unsigned long long offset,
+    char *buffer,
+    size_t length,
+    size_t *bytes)
 {
+    if (segment_) return segment_->read(offset, buffer, length, bytes);
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-readfile
     DWORD len = 0; // 读长度
     OVERLAPPED over = {};
@@ -49,12 +175,18 @@ int File::read(unsigned long long offset, char *buffer, size_t length)
         (DWORD) length,  // buffer大小
         &len,            // 读长度
         &over);          // 偏移量
+    if (bytes) *bytes = len;
     return ret ? S_OK : ::GetLastError();
-    // TODO: len == length??
 }
 
-int File::write(unsigned long long offset, const char *buffer, size_t length)
+int File::write(
+    unsigned long long offset,
+    const char *buffer,
+    size_t length,
+    size_t *bytes)
 {
+    if (map_) return readOnly(bytes);
+    if (segment_) return segment_->write(offset, buffer, length, bytes);
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-writefile
     DWORD len = 0; // 写长度
     OVERLAPPED over = {};
@@ -66,13 +198,146 @@ int File::write(unsigned long long offset, const char *buffer, size_t length)
         (DWORD) length, // buffer长度
         &len,           // 写长度返回值
         &over);         // 设定偏移量
+    if (bytes) *bytes = len;
+    return ret ? S_OK : ::GetLastError();
+}
+
+int File::readv(
+    unsigned long long offset,
+    const struct iovec *iov,
+    int iovcnt,
+    size_t *bytes)
+{
+    if (segment_) return memoryv(this, IO_READ, offset, iov, iovcnt, bytes);
+    // Windows没有preadv，逐段读
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t len = 0;
+        int ret = read(
+            offset + done, (char *) iov[i].iov_base, iov[i].iov_len, &len);
+        done += len;
+        if (ret || len < iov[i].iov_len) {
+            if (bytes) *bytes = done;
+            return ret;
+        }
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+int File::writev(
+    unsigned long long offset,
+    const struct iovec *iov,
+    int iovcnt,
+    size_t *bytes)
+{
+    if (map_) return readOnly(bytes);
+    if (segment_) return memoryv(this, IO_WRITE, offset, iov, iovcnt, bytes);
+    // Windows没有pwritev，逐段写
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size_t len = 0;
+        int ret = write(
+            offset + done, (const char *) iov[i].iov_base, iov[i].iov_len, &len);
+        done += len;
+        if (ret) {
+            if (bytes) *bytes = done;
+            return ret;
+        }
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+int File::allocate(unsigned long long offset, unsigned long long length)
+{
+    if (map_) return EROFS;
+    if (segment_) return segment_->extend(offset + length);
+    // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-setendoffile
+    unsigned long long len;
+    int ret = this->length(len);
+    if (ret) return ret;
+    if (offset + length <= len) return S_OK;
+    LARGE_INTEGER end;
+    end.QuadPart = offset + length;
+    if (!::SetFilePointerEx(handle_, end, NULL, FILE_BEGIN))
+        return ::GetLastError();
+    return ::SetEndOfFile(handle_) ? S_OK : ::GetLastError();
+}
+
+int File::punch(unsigned long long offset, unsigned long long length)
+{
+    if (map_) return EROFS;
+    if (segment_) return segment_->zero(offset, length);
+    // https://docs.microsoft.com/zh-cn/windows/win32/api/winioctl/ni-winioctl-fsctl_set_zero_data
+    FILE_ZERO_DATA_INFORMATION zero;
+    zero.FileOffset.QuadPart = offset;
+    zero.BeyondFinalZero.QuadPart = offset + length;
+    DWORD bytes;
+    bool ret = ::DeviceIoControl(
+        handle_,
+        FSCTL_SET_ZERO_DATA,
+        &zero,
+        sizeof(zero),
+        NULL,
+        0,
+        &bytes,
+        NULL);
     return ret ? S_OK : ::GetLastError();
-    // TODO: len == length??
+}
+
+int File::sync()
+{
+    if (segment_) return S_OK;
+    // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-flushfilebuffers
+    bool ret = ::FlushFileBuffers(handle_);
+    return ret ? S_OK : ::GetLastError();
+}
+
+int File::map(int advice)
+{
+    // https://docs.microsoft.com/zh-cn/windows/win32/api/memoryapi/nf-memoryapi-mapviewoffile
+    unmap();
+    if (segment_) return mapMemory(this);
+    unsigned long long len;
+    int ret = length(len);
+    if (ret) return ret;
+    if (len == 0) return EINVAL;
+    HANDLE mapping =
+        ::CreateFileMappingA(handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) return ::GetLastError();
+    void *addr = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    ret = addr ? S_OK : ::GetLastError();
+    ::CloseHandle(mapping); // 视图保持对mapping的引用
+    if (ret) return ret;
+    map_ = (unsigned char *) addr;
+    mapSize_ = len;
+    return advise(advice);
+}
+
+int File::advise(int advice)
+{
+    if (segment_) return map_ ? S_OK : EINVAL;
+    // Windows没有madvise，由系统自行预读
+    return map_ ? S_OK : EINVAL;
+}
+
+void File::unmap()
+{
+    if (map_) {
+        // 内存段的映射就是段本身
+        if (segment_)
+            segment_->unmap();
+        else
+            ::UnmapViewOfFile(map_);
+        map_ = NULL;
+        mapSize_ = 0;
+    }
 }
 
 int File::remove(const char *path)
 {
-    // TODO: DeleteFile
+    if (Segment::unlink(path)) return S_OK;
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-deletefilea
     bool ret = ::DeleteFileA(path);
     return ret ? S_OK : ::GetLastError();
@@ -80,6 +345,10 @@ int File::remove(const char *path)
 
 int File::length(unsigned long long &len)
 {
+    if (segment_) {
+        len = segment_->length();
+        return S_OK;
+    }
     // https://docs.microsoft.com/zh-cn/windows/win32/api/fileapi/nf-fileapi-getfilesizeex
     LARGE_INTEGER size;
     bool ret = ::GetFileSizeEx(handle_, &size);
@@ -91,4 +360,445 @@ int File::length(unsigned long long &len)
     }
 }
 
-} // namespace db
\ No newline at end of file
+#else
+
+void *alignedAlloc(size_t size)
+{
+    void *buffer = NULL;
+    if (::posix_memalign(&buffer, File::IO_ALIGNMENT, size)) return NULL;
+    return buffer;
+}
+
+void alignedFree(void *buffer) { ::free(buffer); }
+
+// 大页大小
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+void *pageAlloc(size_t size, bool huge, int &pages)
+{
+    void *buffer;
+    if (huge) {
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#    if defined(MAP_HUGETLB)
+        // 先用预留的大页，没有预留时失败
+        buffer = ::mmap(
+            NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+            -1,
+            0);
+        if (buffer != MAP_FAILED) {
+            pages = PAGES_HUGETLB;
+            return buffer;
+        }
+#    endif
+    }
+    buffer = ::mmap(
+        NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) return NULL;
+    pages = PAGES_NORMAL;
+#    if defined(MADV_HUGEPAGE)
+    // 再请求透明大页，内核不支持或关闭时仍是普通页
+    if (huge && ::madvise(buffer, size, MADV_HUGEPAGE) == 0) pages = PAGES_THP;
+#    endif
+    return buffer;
+}
+
+void pageFree(void *buffer, size_t size, int pages)
+{
+    // 与分配时一样按大页取整
+    if (pages != PAGES_NORMAL)
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    ::munmap(buffer, size);
+}
+
+void pageDiscard(void *buffer, size_t size)
+{
+    // 大页上不足2MB的一段会失败，内存留到整体释放时归还
+    ::madvise(buffer, size, MADV_DONTNEED);
+}
+
+int File::open(const char *path, int mode)
+{
+    id_ = nextId();
+    // 内存段，不涉及文件系统
+    if (mode & OPEN_MEMORY) {
+        segment_ = Segment::attach(path);
+        return S_OK;
+    }
+    // 读写打开，缺省不存在则创建，与OPEN_ALWAYS语义一致
+    int flags = O_RDWR | O_CLOEXEC;
+    if (!(mode & OPEN_NOCREATE)) flags |= O_CREAT;
+    if (mode & OPEN_TRUNCATE) flags |= O_TRUNC;
+    if (mode & OPEN_DIRECT) flags |= O_DIRECT;
+    handle_ = ::open(path, flags, 0644);
+    return handle_ == INVALID_HANDLE_VALUE ? errno : S_OK;
+}
+
+void File::close()
+{
+    if (engine_) {
+        delete engine_;
+        engine_ = NULL;
+    }
+    if (committer_) {
+        delete committer_;
+        committer_ = NULL;
+    }
+    unmap();
+    if (handle_ != INVALID_HANDLE_VALUE) {
+        ::close(handle_);
+        handle_ = INVALID_HANDLE_VALUE;
+    }
+    if (segment_) {
+        Segment::detach(segment_);
+        segment_ = NULL;
+    }
+}
+
+int File::read(
+    unsigned long long offset,
+    char *buffer,
+    size_t length,
+    size_t *bytes)
+{
+    if (segment_) return segment_->read(offset, buffer, length, bytes);
+    // pread不移动文件指针，短读时循环直到读满或遇到文件尾
+    size_t done = 0;
+    while (done < length) {
+        ssize_t ret =
+            ::pread(handle_, buffer + done, length - done, offset + done);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (bytes) *bytes = done;
+            return errno;
+        }
+        if (ret == 0) break; // 文件尾
+        done += (size_t) ret;
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+int File::write(
+    unsigned long long offset,
+    const char *buffer,
+    size_t length,
+    size_t *bytes)
+{
+    if (map_) return readOnly(bytes);
+    if (segment_) return segment_->write(offset, buffer, length, bytes);
+    // pwrite不移动文件指针，短写时循环直到写完
+    size_t done = 0;
+    while (done < length) {
+        ssize_t ret =
+            ::pwrite(handle_, buffer + done, length - done, offset + done);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (bytes) *bytes = done;
+            return errno;
+        }
+        if (ret == 0) {
+            // 一个字节也没写进去，不能当作进展一直重试
+            if (bytes) *bytes = done;
+            return EIO;
+        }
+        done += (size_t) ret;
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+// 跳过iov中已经完成的done字节，返回剩余段的起始下标
+static int advance(std::vector<struct iovec> &vec, int index, size_t done)
+{
+    while (done > 0 && index < (int) vec.size()) {
+        if (done >= vec[index].iov_len) {
+            done -= vec[index].iov_len;
+            ++index;
+        } else {
+            vec[index].iov_base = (char *) vec[index].iov_base + done;
+            vec[index].iov_len -= done;
+            done = 0;
+        }
+    }
+    return index;
+}
+
+int File::readv(
+    unsigned long long offset,
+    const struct iovec *iov,
+    int iovcnt,
+    size_t *bytes)
+{
+    if (segment_) return memoryv(this, IO_READ, offset, iov, iovcnt, bytes);
+    // preadv短读时跳过已完成部分，继续读直到读满或遇到文件尾
+    std::vector<struct iovec> vec(iov, iov + iovcnt);
+    size_t done = 0;
+    int index = 0;
+    while (index < iovcnt) {
+        int cnt = iovcnt - index < IOV_MAX ? iovcnt - index : IOV_MAX;
+        ssize_t ret = ::preadv(handle_, &vec[index], cnt, offset + done);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (bytes) *bytes = done;
+            return errno;
+        }
+        if (ret == 0) break; // 文件尾
+        done += (size_t) ret;
+        index = advance(vec, index, (size_t) ret);
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+int File::writev(
+    unsigned long long offset,
+    const struct iovec *iov,
+    int iovcnt,
+    size_t *bytes)
+{
+    if (map_) return readOnly(bytes);
+    if (segment_) return memoryv(this, IO_WRITE, offset, iov, iovcnt, bytes);
+    // pwritev短写时跳过已完成部分，继续写
+    std::vector<struct iovec> vec(iov, iov + iovcnt);
+    size_t done = 0;
+    int index = 0;
+    while (index < iovcnt) {
+        int cnt = iovcnt - index < IOV_MAX ? iovcnt - index : IOV_MAX;
+        ssize_t ret = ::pwritev(handle_, &vec[index], cnt, offset + done);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (bytes) *bytes = done;
+            return errno;
+        }
+        if (ret == 0) {
+            if (bytes) *bytes = done;
+            return EIO;
+        }
+        done += (size_t) ret;
+        index = advance(vec, index, (size_t) ret);
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+int File::allocate(unsigned long long offset, unsigned long long length)
+{
+    if (map_) return EROFS;
+    if (segment_) return segment_->extend(offset + length);
+#if defined(__linux__)
+    // 一次分配整个区间的extent，之后的写不再扩展文件
+    if (::fallocate(handle_, 0, offset, length) == 0) return S_OK;
+    if (errno != EOPNOTSUPP) return errno;
+#endif
+    // 文件系统不支持fallocate，posix_fallocate会退化为写0
+    return ::posix_fallocate(handle_, offset, length);
+}
+
+int File::punch(unsigned long long offset, unsigned long long length)
+{
+    if (map_) return EROFS;
+    if (segment_) return segment_->zero(offset, length);
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    // 保持文件长度不变，只释放区间占用的磁盘空间
+    int ret = ::fallocate(
+        handle_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+    return ret ? errno : S_OK;
+#else
+    return EOPNOTSUPP;
+#endif
+}
+
+int File::sync()
+{
+    if (segment_) return S_OK;
+    // 只需要数据和影响读取的元数据（长度）落盘
+#if defined(__linux__)
+    int ret = ::fdatasync(handle_);
+#else
+    int ret = ::fsync(handle_);
+#endif
+    return ret ? errno : S_OK;
+}
+
+int File::map(int advice)
+{
+    unmap();
+    if (segment_) return mapMemory(this);
+    unsigned long long len;
+    int ret = length(len);
+    if (ret) return ret;
+    if (len == 0) return EINVAL; // 不能映射空文件
+    void *addr = ::mmap(NULL, len, PROT_READ, MAP_SHARED, handle_, 0);
+    if (addr == MAP_FAILED) return errno;
+    map_ = (unsigned char *) addr;
+    mapSize_ = len;
+    return advise(advice);
+}
+
+int File::advise(int advice)
+{
+    if (segment_) return map_ ? S_OK : EINVAL;
+    if (map_ == NULL) return EINVAL;
+    int hint;
+    switch (advice) {
+    case MAP_ADVICE_SEQUENTIAL:
+        hint = MADV_SEQUENTIAL;
+        break;
+    case MAP_ADVICE_RANDOM:
+        hint = MADV_RANDOM;
+        break;
+    case MAP_ADVICE_WILLNEED:
+        hint = MADV_WILLNEED;
+        break;
+    default:
+        hint = MADV_NORMAL;
+        break;
+    }
+    return ::madvise(map_, mapSize_, hint) ? errno : S_OK;
+}
+
+void File::unmap()
+{
+    if (map_) {
+        // 内存段的映射就是段本身
+        if (segment_)
+            segment_->unmap();
+        else
+            ::munmap(map_, mapSize_);
+        map_ = NULL;
+        mapSize_ = 0;
+    }
+}
+
+int File::remove(const char *path)
+{
+    if (Segment::unlink(path)) return S_OK;
+    return ::unlink(path) ? errno : S_OK;
+}
+
+int File::length(unsigned long long &len)
+{
+    if (segment_) {
+        len = segment_->length();
+        return S_OK;
+    }
+    struct stat st;
+    if (::fstat(handle_, &st)) return errno;
+    len = (unsigned long long) st.st_size;
+    return S_OK;
+}
+
+#endif
+
+int File::setDurability(int level, unsigned int window, unsigned int count)
+{
+    if (committer_) {
+        delete committer_;
+        committer_ = NULL;
+    }
+    if (level == DURABILITY_NONE) return S_OK;
+    if (level != DURABILITY_SYNC && level != DURABILITY_GROUP) return EINVAL;
+    committer_ = new Committer(this, level, window, count);
+    return S_OK;
+}
+
+int File::commit()
+{
+    if (committer_ == NULL) return S_OK;
+    return committer_->commit();
+}
+
+SyncStats File::syncStats()
+{
+    if (committer_ == NULL) return SyncStats();
+    return committer_->stats();
+}
+
+int File::setAsync(unsigned int depth, int type)
+{
+    // 内存段没有描述符，只能用线程池
+    if (segment_) type = IO_ENGINE_THREADS;
+    else if (handle_ == INVALID_HANDLE_VALUE) return EINVAL;
+    if (engine_) delete engine_;
+    engine_ = createIoEngine(this, depth, type);
+    return S_OK;
+}
+
+// 映射期间不接受写请求
+static bool hasWrite(const IoRequest *reqs, int count)
+{
+    for (int i = 0; i < count; ++i)
+        if (reqs[i].opcode == IO_WRITE) return true;
+    return false;
+}
+
+int File::submit(IoRequest *reqs, int count)
+{
+    if (engine_ == NULL) return EINVAL;
+    if (map_ && hasWrite(reqs, count)) return EROFS;
+    return engine_->submit(reqs, count);
+}
+
+int File::complete(IoRequest **reqs, int max, int min, int &done)
+{
+    done = 0;
+    if (engine_ == NULL) return EINVAL;
+    return engine_->complete(reqs, max, min, done);
+}
+
+int File::batch(IoRequest *reqs, int count)
+{
+    int ret = S_OK;
+    if (engine_ == NULL) {
+        // 同步模式逐个执行
+        for (int i = 0; i < count; ++i) {
+            IoRequest &req = reqs[i];
+            if (req.opcode == IO_READ)
+                req.result = read(req.offset, req.buffer, req.length, &req.bytes);
+            else
+                req.result =
+                    write(req.offset, req.buffer, req.length, &req.bytes);
+        }
+    } else {
+        // 异步模式一次提交，收割全部完成；没有提交的请求为ECANCELED
+        if (map_ && hasWrite(reqs, count)) return EROFS;
+        for (int i = 0; i < count; ++i) {
+            reqs[i].bytes = 0;
+            reqs[i].result = ECANCELED;
+        }
+        int err = engine_->submit(reqs, count);
+        IoRequest *done[DEFAULT_IO_DEPTH];
+        int left = count;
+        while (err == S_OK && left > 0) {
+            int n = 0;
+            int min = left < (int) DEFAULT_IO_DEPTH ? left : DEFAULT_IO_DEPTH;
+            err = engine_->complete(done, DEFAULT_IO_DEPTH, min, n);
+            left -= n;
+        }
+        if (err) {
+            // 出错时也等已提交的请求结束，否则内核或工作线程之后还会读写
+            // 调用者可能已经释放的buffer
+            engine_->quiesce();
+            int n;
+            do {
+                n = 0;
+                engine_->complete(done, DEFAULT_IO_DEPTH, 0, n);
+            } while (n > 0);
+            return err;
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        IoRequest &req = reqs[i];
+        // 调用者只看result，写不满同样作为失败
+        if (req.result == S_OK && req.opcode == IO_WRITE &&
+            req.bytes != req.length)
+            req.result = EIO;
+        if (req.result && ret == S_OK) ret = req.result;
+    }
+    return ret;
+}
+
+} // namespace db
@@ -0,0 +1,167 @@
+////
+// @file prefetch.cc
+// @brief
+// 实现block链预读
+//
+// @author junix
+//
+#include <db/prefetch.h>
+#include <db/block.h>
+#include <db/buffer.h>
+
+namespace db {
+
+int Prefetcher::reset(File *file, unsigned int window)
+{
+    invalidate();
+    if (frames_) {
+        alignedFree(frames_);
+        frames_ = NULL;
+    }
+    slots_.clear();
+    reqs_.clear();
+    window_ = 0;
+    size_ = 0;
+    next_ = 0;
+    file_ = file;
+    if (file == NULL || window == 0) return S_OK;
+
+    // 预读依赖异步I/O
+    if (!file->async()) {
+        int ret = file->setAsync();
+        if (ret) return ret;
+    }
+    size_ = blockSizeOf(file);
+    frames_ = (unsigned char *) alignedAlloc((size_t) window * size_);
+    if (frames_ == NULL) return ENOMEM;
+    slots_.resize(window);
+    reqs_.resize(window);
+    window_ = window;
+    return S_OK;
+}
+
+bool Prefetcher::get(unsigned int blockid, unsigned char *buffer)
+{
+    if (window_ == 0) return false;
+    int index = find(blockid);
+    if (index < 0) {
+        // 未命中，同样通过帧读入，之后重复访问可以命中
+        ++misses_;
+        issue(blockid);
+        index = find(blockid);
+        if (index < 0) return false;
+    } else
+        ++hits_;
+    wait(index);
+    // 读失败时帧被清空
+    if (slots_[index].blockid != blockid) return false;
+    ::memcpy(buffer, frames_ + (size_t) index * size_, size_);
+    return true;
+}
+
+void Prefetcher::advance(unsigned int nextid, unsigned int limit)
+{
+    if (window_ == 0) return;
+    // 新的读请求先填好，轮转占用的帧是连续的，一起提交；绕回时分两次
+    int first = 0, batch = 0;
+    unsigned int id = nextid;
+    for (unsigned int count = 1; count < window_; ++count) {
+        if (id == 0 || id == (unsigned int) -1 || id > limit) break;
+        int index = find(id);
+        if (index < 0) {
+            // 链上下一个block未知，以物理相邻的block作为提示；在缓冲池中的block
+            // 可能是脏的，文件中的内容已经过时，不读
+            if (!gbuffer.cached(file_, id)) {
+                int slot = prepare(id);
+                if (batch && slot != first + batch) {
+                    submit(first, batch);
+                    batch = 0;
+                }
+                if (batch == 0) first = slot;
+                ++batch;
+            }
+            ++id;
+        } else if (slots_[index].inflight)
+            ++id;
+        else {
+            // 已经读到，沿链继续
+            Block block(frames_ + (size_t) index * size_, size_);
+            id = (unsigned int) block.getNextid();
+        }
+    }
+    if (batch) submit(first, batch);
+}
+
+void Prefetcher::invalidate()
+{
+    for (size_t i = 0; i < slots_.size(); ++i)
+        if (slots_[i].inflight) wait((int) i);
+    for (size_t i = 0; i < slots_.size(); ++i)
+        slots_[i].blockid = 0;
+}
+
+int Prefetcher::find(unsigned int blockid)
+{
+    for (size_t i = 0; i < slots_.size(); ++i)
+        if (slots_[i].blockid == blockid) return (int) i;
+    return -1;
+}
+
+void Prefetcher::wait(int index)
+{
+    while (slots_[index].inflight)
+        reap(1);
+}
+
+void Prefetcher::issue(unsigned int blockid) { submit(prepare(blockid), 1); }
+
+int Prefetcher::prepare(unsigned int blockid)
+{
+    // 轮转替换
+    int index = (int) next_;
+    next_ = (next_ + 1) % window_;
+    Frame &frame = slots_[index];
+    if (frame.inflight) wait(index);
+
+    frame.blockid = blockid;
+    frame.inflight = true;
+    IoRequest &req = reqs_[index];
+    req.opcode = IO_READ;
+    req.offset = (unsigned long long) (blockid - 1) * size_ + Root::ROOT_SIZE;
+    req.buffer = (char *) frames_ + (size_t) index * size_;
+    req.length = size_;
+    req.data = (void *) (size_t) index;
+    return index;
+}
+
+void Prefetcher::submit(int first, int count)
+{
+    if (file_->submit(&reqs_[first], count) == S_OK) return;
+    for (int i = first; i < first + count; ++i) {
+        slots_[i].blockid = 0;
+        slots_[i].inflight = false;
+    }
+}
+
+void Prefetcher::reap(int min)
+{
+    IoRequest *done[16];
+    int n = 0;
+    if (file_->complete(done, 16, min, n) || (n == 0 && min > 0)) {
+        // 引擎已经关闭，放弃所有在读的帧
+        for (size_t i = 0; i < slots_.size(); ++i)
+            if (slots_[i].inflight) {
+                slots_[i].inflight = false;
+                slots_[i].blockid = 0;
+            }
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        Frame &frame = slots_[(size_t) done[i]->data];
+        frame.inflight = false;
+        if (done[i]->result || done[i]->bytes != done[i]->length)
+            frame.blockid = 0;
+    }
+}
+
+} // namespace db
@@ -0,0 +1,244 @@
+////
+// @file replacer.cc
+// @brief
+// 实现页面替换策略
+//
+// @author junix
+//
+#include <list>
+#include <unordered_map>
+#include <db/replacer.h>
+
+namespace db {
+
+// 从链表头开始找第一个未pin的页面，移除并返回
+static Frame *evict(std::list<Frame *> &queue)
+{
+    for (std::list<Frame *>::iterator it = queue.begin(); it != queue.end();
+         ++it) {
+        Frame *frame = *it;
+        if (frame->pins) continue;
+        queue.erase(it);
+        return frame;
+    }
+    return NULL;
+}
+
+////
+// @brief
+// LRU，链表头部最久未用，只用一次的页面放在头部
+//
+class LruReplacer : public Replacer
+{
+  private:
+    std::list<Frame *> queue_;
+
+  public:
+    int type() const { return REPLACE_LRU; }
+
+    void admit(Frame *frame, int flags)
+    {
+        if (flags & PIN_ONCE)
+            frame->hook = queue_.insert(queue_.begin(), frame);
+        else
+            frame->hook = queue_.insert(queue_.end(), frame);
+    }
+    void touch(Frame *frame, int flags)
+    {
+        if (flags & PIN_ONCE) return;
+        queue_.splice(queue_.end(), queue_, frame->hook);
+    }
+    Frame *victim() { return evict(queue_); }
+    void putBack(Frame *frame)
+    {
+        frame->hook = queue_.insert(queue_.begin(), frame);
+    }
+    void remove(Frame *frame) { queue_.erase(frame->hook); }
+};
+
+////
+// @brief
+// CLOCK，指针扫过的页面访问位为1则清0，为0则换出
+//
+class ClockReplacer : public Replacer
+{
+  private:
+    std::list<Frame *> ring_;           // 环
+    std::list<Frame *>::iterator hand_; // 时钟指针
+
+  public:
+    ClockReplacer() { hand_ = ring_.end(); }
+
+    int type() const { return REPLACE_CLOCK; }
+
+    void admit(Frame *frame, int flags)
+    {
+        // 插在指针之前，转一圈之后才会被检查；只用一次的页面指针下次先检查
+        frame->ref = !(flags & PIN_ONCE);
+        frame->hook = ring_.insert(hand_, frame);
+        if (flags & PIN_ONCE) hand_ = frame->hook;
+    }
+    void touch(Frame *frame, int flags)
+    {
+        if (!(flags & PIN_ONCE)) frame->ref = true;
+    }
+    Frame *victim()
+    {
+        // 最多转两圈：第一圈清访问位，第二圈必然找到未pin的页面
+        size_t steps = ring_.size() * 2;
+        for (size_t i = 0; i <= steps; ++i) {
+            if (hand_ == ring_.end()) hand_ = ring_.begin();
+            if (hand_ == ring_.end()) return NULL;
+            Frame *frame = *hand_;
+            if (frame->pins)
+                ++hand_;
+            else if (frame->ref) {
+                frame->ref = false;
+                ++hand_;
+            } else {
+                hand_ = ring_.erase(hand_);
+                return frame;
+            }
+        }
+        return NULL;
+    }
+    void putBack(Frame *frame)
+    {
+        // 访问位已清0，放在指针处，下次先检查
+        frame->ref = false;
+        frame->hook = ring_.insert(hand_, frame);
+        hand_ = frame->hook;
+    }
+    void remove(Frame *frame)
+    {
+        if (hand_ == frame->hook) ++hand_;
+        ring_.erase(frame->hook);
+    }
+};
+
+////
+// @brief
+// 2Q，A1in占容量的1/4，A1out记住最近换出的容量1/2个页面
+//
+class TwoQueueReplacer : public Replacer
+{
+  private:
+    static const int QUEUE_IN = 0;  // A1in
+    static const int QUEUE_HOT = 1; // Am
+
+  private:
+    typedef std::list<unsigned long long> GhostQueue;
+    typedef std::unordered_map<unsigned long long, GhostQueue::iterator>
+        GhostTable;
+
+  private:
+    std::list<Frame *> in_;  // A1in，FIFO
+    std::list<Frame *> hot_; // Am，LRU
+    GhostQueue out_;         // A1out，FIFO，只记录键
+    GhostTable ghost_;       // A1out的索引
+    size_t inMax_;           // A1in上限
+    size_t outMax_;          // A1out上限
+
+  public:
+    TwoQueueReplacer(size_t capacity) { resize(capacity); }
+
+    int type() const { return REPLACE_2Q; }
+
+    void resize(size_t capacity)
+    {
+        inMax_ = capacity / 4 ? capacity / 4 : 1;
+        outMax_ = capacity / 2 ? capacity / 2 : 1;
+    }
+
+    void admit(Frame *frame, int flags)
+    {
+        unsigned long long key = keyOf(frame);
+        GhostTable::iterator it = ghost_.find(key);
+        if (it != ghost_.end() && !(flags & PIN_ONCE)) {
+            // 换出后不久又被访问，进入热队列
+            out_.erase(it->second);
+            ghost_.erase(it);
+            frame->queue = QUEUE_HOT;
+            frame->hook = hot_.insert(hot_.end(), frame);
+            return;
+        }
+        frame->queue = QUEUE_IN;
+        frame->ref = !(flags & PIN_ONCE); // 借用访问位，记录是否进影子队列
+        // 只用一次的页面最先换出
+        if (flags & PIN_ONCE)
+            frame->hook = in_.insert(in_.begin(), frame);
+        else
+            frame->hook = in_.insert(in_.end(), frame);
+    }
+    void touch(Frame *frame, int flags)
+    {
+        // A1in中的命中视为相关访问，不提升
+        if (frame->queue == QUEUE_HOT && !(flags & PIN_ONCE))
+            hot_.splice(hot_.end(), hot_, frame->hook);
+    }
+    Frame *victim()
+    {
+        Frame *frame = NULL;
+        if (in_.size() > inMax_ || hot_.empty()) {
+            frame = evict(in_);
+            if (frame) {
+                if (frame->ref) remember(keyOf(frame));
+                return frame;
+            }
+        }
+        frame = evict(hot_);
+        if (frame) return frame;
+        frame = evict(in_);
+        if (frame && frame->ref) remember(keyOf(frame));
+        return frame;
+    }
+    void putBack(Frame *frame)
+    {
+        // 撤销victim记下的影子，放回原队列的换出端，之后admit不会误提升
+        GhostTable::iterator it = ghost_.find(keyOf(frame));
+        if (it != ghost_.end()) {
+            out_.erase(it->second);
+            ghost_.erase(it);
+        }
+        if (frame->queue == QUEUE_HOT)
+            frame->hook = hot_.insert(hot_.begin(), frame);
+        else
+            frame->hook = in_.insert(in_.begin(), frame);
+    }
+    void remove(Frame *frame)
+    {
+        if (frame->queue == QUEUE_HOT)
+            hot_.erase(frame->hook);
+        else
+            in_.erase(frame->hook);
+    }
+
+  private:
+    static unsigned long long keyOf(Frame *frame)
+    {
+        return (frame->fileid << 32) ^ frame->blockid;
+    }
+    void remember(unsigned long long key)
+    {
+        if (ghost_.count(key)) return;
+        ghost_[key] = out_.insert(out_.end(), key);
+        while (out_.size() > outMax_) {
+            ghost_.erase(out_.front());
+            out_.pop_front();
+        }
+    }
+};
+
+Replacer *createReplacer(int type, size_t capacity)
+{
+    switch (type) {
+    case REPLACE_CLOCK:
+        return new ClockReplacer();
+    case REPLACE_2Q:
+        return new TwoQueueReplacer(capacity);
+    default:
+        return new LruReplacer();
+    }
+}
+
+} // namespace db
@@ -10,6 +10,7 @@
 #include <db/block.h>
 #include <db/endian.h>
 #include <db/record.h>
+#include <db/buffer.h>
 
 namespace db {
 
@@ -17,15 +18,35 @@ const char *Schema::META_FILE = "meta.db";
 
 Schema::Schema(const char *name)
     : name_(name)
+    , buffer_(NULL)
+    , page_(NULL)
+    , mode_(0)
+{}
+Schema::~Schema() { release(); }
+
+void Schema::release()
+{
+    if (page_) {
+        gbuffer.unpin(page_);
+        page_ = NULL;
+        buffer_ = NULL;
+    }
+}
+
+int Schema::destroy()
 {
-    buffer_ = (unsigned char *) malloc(Block::BLOCK_SIZE);
+    release();
+    gbuffer.drop(&metafile_);
+    metafile_.close();
+    return metafile_.remove(name_.c_str());
 }
-Schema::~Schema() { free(buffer_); }
 
-int Schema::open()
+int Schema::open(bool mapped, int mode)
 {
     // 打开文件
-    int ret = metafile_.open(name_.c_str());
+    release();
+    mode_ = mode;
+    int ret = metafile_.open(name_.c_str(), mode);
     if (ret) return ret;
 
     // 如果meta.db长度为0，则写一个block
@@ -33,18 +54,36 @@ int Schema::open()
     ret = metafile_.length(length);
     if (ret) return ret;
     if (length) {
+        // 映射模式直接从映射页面加载，不拷贝
+        if (mapped) {
+            ret = metafile_.map(MAP_ADVICE_WILLNEED);
+            if (ret) return ret;
+        }
         // 加载
-        metafile_.read(0, (char *) buffer_, Root::ROOT_SIZE);
+        Frame *frame = NULL;
+        unsigned char *page = metafile_.view(0, Root::ROOT_SIZE);
+        if (page == NULL) {
+            ret = gbuffer.pin(&metafile_, 0, frame);
+            if (ret) return ret;
+            page = frame->data;
+        }
         // TODO: 检查root？
         // 获取第1个block
         Root root;
-        root.attach(buffer_);
+        root.attach(page);
         unsigned int first = root.getHead();
+        if (frame) gbuffer.unpin(frame);
         size_t offset = (first - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-        metafile_.read(offset, (char *) buffer_, Block::BLOCK_SIZE);
+        page = metafile_.view(offset, Block::BLOCK_SIZE);
+        if (page == NULL) {
+            // 当前meta块pin住直到关闭，create在其中分配
+            ret = gbuffer.pin(&metafile_, first, page_);
+            if (ret) return ret;
+            buffer_ = page = page_->data;
+        }
         // 加载tablespace_
         MetaBlock block;
-        block.attach(buffer_);
+        block.attach(page);
         unsigned short count = block.getSlotsNum();
         for (unsigned short i = 0; i < count; ++i) {
             // 获取slot
@@ -52,7 +91,7 @@ int Schema::open()
             RelationInfo info;
             // 得到记录
             Record record;
-            unsigned char *rb = buffer_ + slotoff;
+            unsigned char *rb = page + slotoff;
             record.attach(rb, Block::BLOCK_SIZE);
             // 先分配iovec
             size_t fields = record.fields();
@@ -70,19 +109,29 @@ int Schema::open()
         }
     } else {
         // 创建root
+        Frame *frame;
+        ret = gbuffer.pin(&metafile_, 0, frame, PIN_NEW);
+        if (ret) return ret;
         Root root;
-        unsigned char rb[Root::ROOT_SIZE];
-        root.attach(rb);
+        root.attach(frame->data);
         root.clear(BLOCK_TYPE_META);
         root.setHead(1);
+        gbuffer.markDirty(frame);
+        ret = gbuffer.flush(frame);
+        gbuffer.unpin(frame);
+        if (ret) return ret;
         // 创建第1个block
+        ret = gbuffer.pin(&metafile_, 1, page_, PIN_NEW);
+        if (ret) return ret;
+        buffer_ = page_->data;
         MetaBlock block;
         block.attach(buffer_);
         block.clear(1);
-        // 写root和block
-        metafile_.write(0, (const char *) rb, Root::ROOT_SIZE);
-        metafile_.write(
-            Root::ROOT_SIZE, (const char *) buffer_, Block::BLOCK_SIZE);
+        // 写block
+        gbuffer.markDirty(page_);
+        ret = gbuffer.flush(page_);
+        if (ret) return ret;
+        if (mapped) return metafile_.map(MAP_ADVICE_WILLNEED);
     }
 
     return S_OK;
@@ -91,6 +140,8 @@ int Schema::open()
 int Schema::create(const char *table, RelationInfo &info)
 {
     if ((size_t) info.count != info.fields.size()) return EINVAL;
+    // 映射模式只读
+    if (metafile_.mapped()) return EROFS;
 
     // 先将info转化iov
     int total = 7; // 未包括域的描述信息，需要保存5个字段
@@ -118,12 +169,11 @@ int Schema::create(const char *table, RelationInfo &info)
     // 处理checksum
     meta.setChecksum();
     // 写meta文件
-    unsigned int blockid = meta.blockid() - 1;
-    size_t offset = blockid * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    metafile_.write(offset, (const char *) buffer_, Block::BLOCK_SIZE);
+    gbuffer.markDirty(page_);
+    int err = gbuffer.flush(page_);
 
     free(iov);
-    return S_OK;
+    return err;
 }
 
 std::pair<Schema::TableSpace::iterator, bool> Schema::lookup(const char *table)
@@ -134,9 +184,10 @@ std::pair<Schema::TableSpace::iterator, bool> Schema::lookup(const char *table)
     return std::pair<TableSpace::iterator, bool>(it, ret);
 }
 
-int Schema::load(TableSpace::iterator it)
+int Schema::load(TableSpace::iterator it, int mode)
 {
-    return it->second.file.open(it->second.path.c_str());
+    return it->second.file.open(
+        it->second.path.c_str(), mode | (mode_ & OPEN_MEMORY));
 }
 
 void Schema::initIov(const char *table, RelationInfo &info, struct iovec *iov)
@@ -217,6 +268,6 @@ void Schema::retrieveInfo(
 
 Schema gschema;
 
-int dbInitialize() { return gschema.open(); }
+int dbInitialize(int mode) { return gschema.open(false, mode); }
 
 } // namespace db
\ No newline at end of file
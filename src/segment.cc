@@ -0,0 +1,146 @@
+////
+// @file segment.cc
+// @brief
+// 实现内存段
+//
+// @author junix
+//
+#include <map>
+#include <string>
+#include <db/segment.h>
+
+namespace db {
+
+namespace {
+
+// 路径到内存段的登记表
+std::mutex gsegmentLock;
+std::map<std::string, Segment *> gsegments;
+
+} // namespace
+
+Segment *Segment::attach(const char *path)
+{
+    std::lock_guard<std::mutex> lock(gsegmentLock);
+    Segment *&segment = gsegments[path];
+    if (segment == NULL) segment = new Segment;
+    ++segment->refs_;
+    return segment;
+}
+
+void Segment::detach(Segment *segment)
+{
+    std::lock_guard<std::mutex> lock(gsegmentLock);
+    if (--segment->refs_ == 0 && !segment->linked_) delete segment;
+}
+
+bool Segment::unlink(const char *path)
+{
+    std::lock_guard<std::mutex> lock(gsegmentLock);
+    std::map<std::string, Segment *>::iterator it = gsegments.find(path);
+    if (it == gsegments.end()) return false;
+    Segment *segment = it->second;
+    gsegments.erase(it);
+    segment->linked_ = false;
+    if (segment->refs_ == 0) delete segment;
+    return true;
+}
+
+int Segment::read(
+    unsigned long long offset,
+    char *buffer,
+    size_t length,
+    size_t *bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t done = 0;
+    if (offset < size_) {
+        done = size_ - offset < length ? (size_t) (size_ - offset) : length;
+        ::memcpy(buffer, data_ + offset, done);
+    }
+    if (bytes) *bytes = done;
+    return S_OK;
+}
+
+int Segment::write(
+    unsigned long long offset,
+    const char *buffer,
+    size_t length,
+    size_t *bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int ret = reserve(offset + length);
+    if (ret) {
+        if (bytes) *bytes = 0;
+        return ret;
+    }
+    ::memcpy(data_ + offset, buffer, length);
+    if (bytes) *bytes = length;
+    return S_OK;
+}
+
+int Segment::extend(unsigned long long length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reserve(length);
+}
+
+int Segment::zero(unsigned long long offset, unsigned long long length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 与打洞一致，不改变长度
+    if (offset >= size_) return S_OK;
+    if (offset + length > size_) length = size_ - offset;
+    ::memset(data_ + offset, 0, (size_t) length);
+    return S_OK;
+}
+
+unsigned long long Segment::length()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
+
+unsigned char *Segment::data()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return data_;
+}
+
+unsigned char *Segment::map()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++maps_;
+    return data_;
+}
+
+void Segment::unmap()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    --maps_;
+}
+
+int Segment::reserve(unsigned long long length)
+{
+    if (length <= size_) return S_OK;
+    if (length > limit_) {
+        // 重新分配会使映射视图失效
+        if (maps_) return EBUSY;
+        unsigned long long limit = limit_ ? limit_ : File::IO_ALIGNMENT;
+        while (limit < length)
+            limit *= 2;
+        if (limit != (size_t) limit) return ENOMEM;
+        unsigned char *data = (unsigned char *) alignedAlloc((size_t) limit);
+        if (data == NULL) return ENOMEM;
+        if (data_) ::memcpy(data, data_, (size_t) size_);
+        alignedFree(data_);
+        data_ = data;
+        limit_ = limit;
+    }
+    // 新增部分读到0
+    ::memset(data_ + size_, 0, (size_t) (length - size_));
+    size_ = length;
+    return S_OK;
+}
+
+} // namespace db
@@ -8,60 +8,125 @@
 #include <db/table.h>
 namespace db {
 
+const char *Table::WARM_SUFFIX = ".warm";
+
 Table::Table()
-    : relationInfo(NULL)
+    : DataBlockCnt(0)
+    , allocated_(0)
+    , extent_(DEFAULT_EXTENT_BLOCKS)
+    , punch_(false)
+    , relationInfo(NULL)
+    , buffer_(NULL)
+    , root_(NULL)
+    , page_(NULL)
+    , rootPage_(NULL)
+    , blockSize_(Block::BLOCK_SIZE)
+    , algorithm_(CHECKSUM_CRC32C)
+{
+    // 按direct I/O要求对齐
+    split_ = (unsigned char *) alignedAlloc(blockSize_);
+}
+Table::~Table()
 {
-    buffer_ = (unsigned char *) malloc(Block::BLOCK_SIZE);
+    release();
+    alignedFree(split_);
 }
-Table::~Table() { free(buffer_); }
 
 int Table::create(const char *name, RelationInfo &info)
 {
     return gschema.create(name, info);
 }
-int Table::open(const char *name)
+int Table::open(const char *name, int mode)
 {
     // 查找schema
     std::pair<Schema::TableSpace::iterator, bool> bret = gschema.lookup(name);
     if (!bret.second) return EINVAL;
     // 找到后，加载meta信息
-    gschema.load(bret.first);
+    int ret = gschema.load(bret.first, mode);
+    if (ret) return ret;
     relationInfo = &bret.first->second;
+    // block大小记在root中，预热之前取得
+    ret = loadFormat();
+    if (ret) return ret;
+    // 按上次保存的列表预热缓冲池，列表不存在或损坏时忽略
+    if (!(mode & OPEN_MEMORY)) {
+        std::string path = relationInfo->path + WARM_SUFFIX;
+        gbuffer.restore(&relationInfo->file, path.c_str());
+    }
     return S_OK;
 }
-void Table::close(const char *name) { relationInfo->file.close(); }
-int Table::destroy(const char *name) { return relationInfo->file.remove(name); }
+int Table::dumpBuffer()
+{
+    // 内存段不跨进程，不需要预热
+    if (relationInfo->file.segment_) return S_OK;
+    std::string path = relationInfo->path + WARM_SUFFIX;
+    return gbuffer.dump(&relationInfo->file, path.c_str());
+}
+void Table::close(const char *name)
+{
+    // 先停止预读，做检查点，保存缓冲的block列表，放掉缓冲页面，再关闭文件
+    prefetch_.reset(NULL, 0);
+    if (rootPage_) gbuffer.checkpoint(&relationInfo->file);
+    dumpBuffer();
+    release();
+    gbuffer.drop(&relationInfo->file);
+    relationInfo->file.close();
+}
+int Table::destroy(const char *name)
+{
+    std::string path = std::string(name) + WARM_SUFFIX;
+    File::remove(path.c_str());
+    return relationInfo->file.remove(name);
+}
 int Table::initial()
 {
     unsigned long long length;
     int ret = relationInfo->file.length(length);
     if (ret) return ret;
-    // 加载
+    // 加载，root在缓冲池中pin住直到关闭
     if (length) {
-        relationInfo->file.read(0, (char *) buffer_, Root::ROOT_SIZE);
+        if (rootPage_ == NULL) {
+            ret = gbuffer.pin(&relationInfo->file, 0, rootPage_);
+            if (ret) return ret;
+            root_ = rootPage_->data;
+        }
         Root root;
-        root.attach(buffer_);
+        root.attach(root_);
         unsigned int first = root.getHead();
         DataBlockCnt = root.getCnt();
-        size_t offset = (first - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-        relationInfo->file.read(offset, (char *) buffer_, Block::BLOCK_SIZE);
+        allocated_ = root.getAllocated();
+        return load(first);
     } else {
+        release();
+        ret = gbuffer.pin(&relationInfo->file, 0, rootPage_, PIN_NEW);
+        if (ret) return ret;
+        root_ = rootPage_->data;
+        ret = load(1, PIN_NEW);
+        if (ret) return ret;
         Root root;
-        unsigned char rb[Root::ROOT_SIZE];
-        root.attach(rb);
+        root.attach(root_);
         root.clear(BLOCK_TYPE_DATA);
+        root.setBlockSize(blockSize_);
+        root.setChecksumAlgorithm(algorithm_);
+        root.setFormat(Root::FORMAT_VERSION);
         root.setHead(1);
         // 创建第1个block
         DataBlock block;
-        block.attach(buffer_);
+        block.attach(buffer_, blockSize_, algorithm_);
         block.clear(1);
         block.setNextid(-1);
+        block.setChecksum();
         DataBlockCnt = 1;
         root.setCnt(DataBlockCnt);
-        // 写root和block
-        relationInfo->file.write(0, (const char *) rb, Root::ROOT_SIZE);
-        relationInfo->file.write(
-            Root::ROOT_SIZE, (const char *) buffer_, Block::BLOCK_SIZE);
+        // 预分配第1个extent
+        allocated_ = 0;
+        reserve(DataBlockCnt);
+        // 新页面还没有标脏，不会被写回线程读到，不需要latch；root和第1个block
+        // 马上写回，相邻的两个页面合并为一次writev
+        gbuffer.markDirty(rootPage_);
+        gbuffer.markDirty(page_);
+        ret = gbuffer.flush(&relationInfo->file);
+        if (ret) return ret;
     }
     return S_OK;
 }
@@ -93,32 +158,39 @@ int Table::initial()
 //     if (ret) return ret;
 //     return S_OK;
 // }
-int Table::splitDataBlock(int blockid)
+int Table::splitDataBlock(int blockid, unsigned short count)
 {
     //原block
     int nextid;
     DataBlock block;
-    size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->file.read(offset, (char *) buffer_, Block::BLOCK_SIZE);
-    block.attach(buffer_);
+    int ret = load(blockid);
+    if (ret) return ret;
+    block.attach(buffer_, blockSize_, algorithm_);
     nextid = block.getNextid();
 
-    //分裂的新block
+    //分裂的新block，前一半先放在split_，后一半直接写到新页面
     DataBlock newBlock1, newBlock2;
-    unsigned char db1[Block::BLOCK_SIZE];
-    unsigned char db2[Block::BLOCK_SIZE];
-    newBlock1.attach(db1);
+    Frame *frame;
+    unsigned int newid;
+    ret = takeBlock(newid, frame);
+    if (ret) return ret;
+    page_->latch.lock();
+    frame->latch.lock();
+    unsigned char *db1 = split_;
+    unsigned char *db2 = frame->data;
+    newBlock1.attach(db1, blockSize_, algorithm_);
     newBlock1.clear(block.blockid());
-    newBlock1.setNextid(++DataBlockCnt);
-    newBlock2.attach(db2);
-    newBlock2.clear(DataBlockCnt);
+    newBlock1.setNextid(newid);
+    newBlock2.attach(db2, blockSize_, algorithm_);
+    newBlock2.clear(newid);
     newBlock2.setNextid(nextid);
 
     unsigned short slotsNum = block.getSlotsNum();
-    for (unsigned short index = 0; index < slotsNum / 2; index++) {
+    if (count == 0 || count > slotsNum) count = slotsNum / 2;
+    for (unsigned short index = 0; index < count; index++) {
         unsigned short recOffset = block.getSlot(index);
         Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+        record.attach(buffer_ + recOffset, blockSize_ - recOffset);
         // 先分配iovec
         size_t fields = record.fields();
         struct iovec *iov = (struct iovec *) malloc(sizeof(iovec) * fields);
@@ -130,10 +202,10 @@ int Table::splitDataBlock(int blockid)
         free(iov);
     }
 
-    for (unsigned short index = slotsNum / 2; index < slotsNum; index++) {
+    for (unsigned short index = count; index < slotsNum; index++) {
         unsigned short recOffset = block.getSlot(index);
         Record record;
-        record.attach(buffer_ + recOffset, Block::BLOCK_SIZE);
+        record.attach(buffer_ + recOffset, blockSize_ - recOffset);
 
         // 先分配iovec
         size_t fields = record.fields();
@@ -146,226 +218,572 @@ int Table::splitDataBlock(int blockid)
         free(iov);
     }
 
-    //写block
-    offset = (newBlock1.blockid() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->file.write(offset, (const char *) db1, Block::BLOCK_SIZE);
+    // 按搬移后的记录设定fence
+    newBlock1.resetFence(relationInfo->key);
+    newBlock2.resetFence(relationInfo->key);
+    newBlock1.setChecksum();
+    newBlock2.setChecksum();
 
-    offset = (newBlock2.blockid() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->file.write(offset, (const char *) db2, Block::BLOCK_SIZE);
+    // 原block的页面换成前一半
+    ::memcpy(buffer_, db1, blockSize_);
 
-    //更新root
-    int ret = writeRoot();
+    // 两个block标脏，root在takeBlock中已标脏，由后台写回
+    frame->latch.unlock();
+    page_->latch.unlock();
+    gbuffer.markDirty(frame);
+    gbuffer.markDirty(page_);
+    gbuffer.unpin(frame);
+    prefetch_.invalidate();
+    return S_OK;
+}
+int Table::takeBlock(unsigned int &blockid, Frame *&frame)
+{
+    Root root;
+    root.attach(root_);
+    unsigned int garbage = (unsigned int) root.getGarbage();
+    if (garbage == 0) {
+        // 空闲链为空，扩展文件，超出预分配范围时再分配一个extent
+        int ret = gbuffer.pin(
+            &relationInfo->file, DataBlockCnt + 1, frame, PIN_NEW);
+        if (ret) return ret;
+        rootPage_->latch.lock();
+        blockid = ++DataBlockCnt;
+        root.setCnt(DataBlockCnt);
+        reserve(DataBlockCnt);
+        rootPage_->latch.unlock();
+        gbuffer.markDirty(rootPage_);
+        return S_OK;
+    }
+    // 取空闲链头，其nextid为下一个空闲block；打过洞的block只有头部可信，不检验
+    int ret = gbuffer.pin(&relationInfo->file, garbage, frame, PIN_NOVERIFY);
+    if (ret) return ret;
+    DataBlock block;
+    block.attach(frame->data, blockSize_, algorithm_);
+    rootPage_->latch.lock();
+    root.setGarbage(block.getNextid());
+    rootPage_->latch.unlock();
+    gbuffer.markDirty(rootPage_);
+    blockid = garbage;
+    return S_OK;
+}
+int Table::freeBlock(unsigned int blockid, unsigned int prev)
+{
+    DataBlock block;
+    block.attach(buffer_, blockSize_, algorithm_);
+    unsigned int nextid = (unsigned int) block.getNextid();
+    // 表至少保留一个block
+    if (prev == 0 && nextid == (unsigned int) -1) return writeBlock();
+
+    if (prev) {
+        // 前驱越过空block指向其后继
+        Frame *frame;
+        int ret = gbuffer.pin(&relationInfo->file, prev, frame);
+        if (ret) return ret;
+        frame->latch.lock();
+        DataBlock pred;
+        pred.attach(frame->data, blockSize_, algorithm_);
+        pred.setNextid(nextid);
+        pred.setChecksum();
+        frame->latch.unlock();
+        gbuffer.markDirty(frame);
+        gbuffer.unpin(frame);
+    }
+
+    // 空block挂到空闲链头，空闲链通过nextid串起来，0表示链尾
+    Root root;
+    root.attach(root_);
+    page_->latch.lock();
+    block.clear(blockid);
+    block.setType(BLOCK_TYPE_FREE);
+    block.setNextid(root.getGarbage());
+    block.setChecksum();
+    page_->latch.unlock();
+    gbuffer.markDirty(page_);
+    rootPage_->latch.lock();
+    if (prev == 0) root.setHead(nextid);
+    root.setGarbage(blockid);
+    rootPage_->latch.unlock();
+    gbuffer.markDirty(rootPage_);
+    prefetch_.invalidate();
+
+    // 保留block头部所在的页，空闲链仍然可读，其余部分还给文件系统；
+    // 先写回，否则之后的写回会把洞重新填上。4KB的block只有头部一页，不打洞
+    if (punch_ && blockSize_ > File::IO_ALIGNMENT) {
+        int ret = gbuffer.flush(page_);
+        if (ret) return ret;
+        size_t offset = (size_t) (blockid - 1) * blockSize_ + Root::ROOT_SIZE;
+        ret = relationInfo->file.punch(
+            offset + File::IO_ALIGNMENT, blockSize_ - File::IO_ALIGNMENT);
+        // 文件系统不支持打洞时block照常留在空闲链上，只是空间不还回去
+        if (ret && ret != EOPNOTSUPP) return ret;
+    }
+    return S_OK;
+}
+int Table::map(int advice)
+{
+    // 映射看到的是文件内容，先写回脏页
+    int ret = gbuffer.flush(&relationInfo->file);
     if (ret) return ret;
+    return relationInfo->file.map(advice);
+}
+void Table::unmap() { relationInfo->file.unmap(); }
+int Table::setDurability(int level, unsigned int window, unsigned int count)
+{
+    return relationInfo->file.setDurability(level, window, count);
+}
+int Table::fetch(unsigned int blockid, unsigned char *&data, int flags)
+{
+    size_t offset = (size_t) (blockid - 1) * blockSize_ + Root::ROOT_SIZE;
+    data = relationInfo->file.view(offset, blockSize_);
+    if (data) return S_OK;
+    if (page_ && page_->blockid == blockid) {
+        data = buffer_;
+        return S_OK;
+    }
+    if (prefetch_.window() == 0) {
+        int ret = load(blockid, flags);
+        if (ret) return ret;
+        data = buffer_;
+        return S_OK;
+    }
+
+    // 缓冲池未命中时从预读帧取；填好、检验之前页面处于读入中，
+    // 其它pin等待，不会看到没有填写的页面
+    Frame *frame;
+    int ret = gbuffer.pin(
+        &relationInfo->file, blockid, frame, flags | PIN_FILL);
+    if (ret == S_OK) {
+        size_t bytes = blockSize_;
+        bool hit = prefetch_.get(blockid, frame->data);
+        if (!hit) {
+            ret = relationInfo->file.read(
+                offset, (char *) frame->data, blockSize_, &bytes);
+            // 读不满时同样作为失败，不能把内容不对的页面留在缓冲池中
+            if (ret == S_OK && bytes != blockSize_) ret = EIO;
+        }
+        // 按策略检验，失败的页面在unpin时丢弃
+        ret = gbuffer.filled(frame, ret, bytes, flags);
+        if (ret) {
+            gbuffer.unpin(frame);
+            return ret;
+        }
+        if (hit) {
+            // 沿链为后续block发起预读
+            DataBlock block;
+            block.attach(frame->data, blockSize_, algorithm_);
+            prefetch_.advance(block.getNextid(), DataBlockCnt);
+        }
+    } else if (ret != S_FALSE)
+        return ret;
+    if (page_) gbuffer.unpin(page_);
+    page_ = frame;
+    buffer_ = frame->data;
+    data = buffer_;
+    return S_OK;
+}
+int Table::load(unsigned int blockid, int flags)
+{
+    if (page_ && page_->blockid == blockid && !(flags & PIN_NEW)) return S_OK;
+    Frame *frame;
+    int ret = gbuffer.pin(&relationInfo->file, blockid, frame, flags);
+    if (ret) return ret;
+    if (page_) gbuffer.unpin(page_);
+    page_ = frame;
+    buffer_ = frame->data;
+    return S_OK;
+}
+unsigned int Table::head()
+{
+    unsigned char *rb = relationInfo->file.view(0, Root::ROOT_SIZE);
+    if (rb == NULL) rb = root_;
+    Frame *frame = NULL;
+    if (rb == NULL) {
+        // 还没有initial，临时pin住root
+        if (gbuffer.pin(&relationInfo->file, 0, frame)) return -1;
+        rb = frame->data;
+    }
+    Root root;
+    root.attach(rb);
+    unsigned int first = root.getHead();
+    if (frame) gbuffer.unpin(frame);
+    return first;
+}
+void Table::release()
+{
+    if (page_) {
+        gbuffer.unpin(page_);
+        page_ = NULL;
+        buffer_ = NULL;
+    }
+    if (rootPage_) {
+        gbuffer.unpin(rootPage_);
+        rootPage_ = NULL;
+        root_ = NULL;
+    }
+}
+int Table::setReadahead(unsigned int window)
+{
+    return prefetch_.reset(&relationInfo->file, window);
+}
+void Table::setExtent(unsigned int blocks) { extent_ = blocks ? blocks : 1; }
+int Table::setBlockSize(unsigned int size)
+{
+    if (!Block::validSize(size)) return EINVAL;
+    // 已经写过的表不能改变block大小
+    unsigned long long length;
+    int ret = relationInfo->file.length(length);
+    if (ret) return ret;
+    if (length || rootPage_) return EBUSY;
+    return applyBlockSize(size);
+}
+int Table::setChecksumAlgorithm(int algorithm)
+{
+    if (algorithm != CHECKSUM_INET && algorithm != CHECKSUM_CRC32C)
+        return EINVAL;
+    unsigned long long length;
+    int ret = relationInfo->file.length(length);
+    if (ret) return ret;
+    if (length || rootPage_) return EBUSY;
+    algorithm_ = algorithm;
+    relationInfo->file.algorithm_ = algorithm;
+    return S_OK;
+}
+int Table::loadFormat()
+{
+    // 新表缺省用CRC32C
+    unsigned int size = Block::BLOCK_SIZE;
+    algorithm_ = CHECKSUM_CRC32C;
+    unsigned long long length;
+    int ret = relationInfo->file.length(length);
+    if (ret) return ret;
+    if (length) {
+        Frame *frame;
+        ret = gbuffer.pin(&relationInfo->file, 0, frame);
+        if (ret) return ret;
+        Root root;
+        root.attach(frame->data);
+        unsigned int version = root.getFormat();
+        size = root.getBlockSize();
+        algorithm_ = root.getChecksumAlgorithm();
+        gbuffer.unpin(frame);
+        // 旧格式的记录从28B开始，与fence所在的头部重叠，按新格式读会读到
+        // 错误的fence，写则会改坏记录，不支持打开
+        if (version != Root::FORMAT_VERSION) return ENOTSUP;
+        if (!Block::validSize(size)) return EINVAL;
+        if (algorithm_ != CHECKSUM_INET && algorithm_ != CHECKSUM_CRC32C)
+            return EINVAL;
+    }
+    // 缓冲池读入block时按此算法检验
+    relationInfo->file.algorithm_ = algorithm_;
+    return applyBlockSize(size);
+}
+int Table::applyBlockSize(unsigned int size)
+{
+    if (size != blockSize_) {
+        unsigned char *split = (unsigned char *) alignedAlloc(size);
+        if (split == NULL) return ENOMEM;
+        alignedFree(split_);
+        split_ = split;
+        blockSize_ = size;
+    }
+    // 缓冲池和预读按文件的block大小读写
+    relationInfo->file.blockSize_ = size;
+    if (prefetch_.window())
+        return prefetch_.reset(&relationInfo->file, prefetch_.window());
     return S_OK;
 }
+int Table::reserve(unsigned int count)
+{
+    if (count <= allocated_) return S_OK;
+    // 按extent整块分配
+    unsigned int target = allocated_;
+    while (target < count)
+        target += extent_;
+    unsigned long long offset =
+        (unsigned long long) allocated_ * blockSize_ + Root::ROOT_SIZE;
+    unsigned long long length =
+        (unsigned long long) (target - allocated_) * blockSize_;
+    // 预分配失败不影响正确性，文件照常在写时扩展
+    int ret = relationInfo->file.allocate(offset, length);
+    allocated_ = target;
+    Root root;
+    root.attach(root_);
+    root.setAllocated(allocated_);
+    return ret;
+}
 int Table::blockid()
 {
     DataBlock block;
-    block.attach(buffer_);
+    block.attach(buffer_, blockSize_, algorithm_);
     return block.blockid();
 }
 unsigned short Table::freelength()
 {
     DataBlock block;
-    block.attach(buffer_);
+    block.attach(buffer_, blockSize_, algorithm_);
     return block.getFreeLength();
 }
 unsigned short Table::slotsNum()
 {
     DataBlock block;
-    block.attach(buffer_);
+    block.attach(buffer_, blockSize_, algorithm_);
     return block.getSlotsNum();
 }
 int Table::writeBlock()
 {
-    DataBlock data;
-    data.attach(buffer_);
-    unsigned int blockid = data.blockid();
-    size_t offset = (blockid - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
-    relationInfo->file.write(offset, (const char *) buffer_, Block::BLOCK_SIZE);
+    // 当前block在缓冲池中已修改，标脏，由后台写回
+    gbuffer.markDirty(page_);
+    prefetch_.invalidate();
     return S_OK;
 }
 int Table::writeRoot()
 {
-    relationInfo->file.read(0, (char *) buffer_, Root::ROOT_SIZE);
+    // root在initial时已pin住，不需要重新读
     Root root;
-    root.attach(buffer_);
+    root.attach(root_);
+    rootPage_->latch.lock();
     root.setCnt(DataBlockCnt);
-    relationInfo->file.write(0, (const char *) buffer_, Root::ROOT_SIZE);
+    rootPage_->latch.unlock();
+    gbuffer.markDirty(rootPage_);
     return S_OK;
 }
+int Table::commit()
+{
+    File &file = relationInfo->file;
+    int ret;
+    if (file.committer_)
+        ret = gbuffer.flush(&file); // 要求刷盘，先写回本表的脏页
+    else
+        ret = gbuffer.throttle(); // 脏页过多时等待写回
+    if (ret) return ret;
+    // 按持久性设定刷盘
+    return file.commit();
+}
+int Table::place(
+    blockIter &bit,
+    DataBlock &data,
+    const unsigned char *header,
+    struct iovec *record,
+    int iovcnt)
+{
+    unsigned int key = relationInfo->key;
+    iovec &keyField = record[key];
+    DataType *type = keyType();
+    for (;;) {
+        data = *bit;
+        if (bit.getError()) return bit.getError();
+        // 空block也放不下，分裂没有用
+        if (!data.fits(record, iovcnt)) return EINVAL;
+        page_->latch.lock();
+        if (data.insert(key, type, header, record, iovcnt)) return S_OK;
+        page_->latch.unlock();
+
+        // 放不下，分裂之后在key落入的一半中重试；只有一条记录时按插入位置
+        // 分，保证新记录落入的一半为空，否则会一直分裂下去
+        unsigned short count = 0;
+        if (data.getSlotsNum() == 1) {
+            bool found;
+            count = data.search(key, type, keyField, found);
+        }
+        int ret = splitDataBlock(data.blockid(), count);
+        if (ret) return ret;
+
+        // 后一半为空或key不小于其最小key时落入后一半
+        blockIter next(bit);
+        ++next;
+        DataBlock &upper = *next;
+        if (next.getError()) return next.getError();
+        iovec low;
+        if (!upper.getLow(key, low) ||
+            !type->compare(
+                keyField.iov_base,
+                low.iov_base,
+                keyField.iov_len,
+                low.iov_len))
+            ++bit;
+    }
+}
 int Table::insert(const unsigned char *header, struct iovec *record, int iovcnt)
 {
+    // 映射模式只读
+    if (relationInfo->file.mapped()) return EROFS;
     //打开block
-    bool ret = initial();
+    int ret = initial();
     if (ret) return ret;
     unsigned int key = relationInfo->key;
     iovec &keyField = record[key];
+    DataType *type = keyType();
     DataBlock data;
 
-    for (auto bit1 = blockBegin(), bit2 = ++blockBegin(); bit1 != blockEnd();
-         ++bit1, ++bit2) {
+    // 读block失败时迭代器记下错误并结束，循环之后返回
+    blockIter bit1 = blockBegin(), bit2 = ++blockBegin();
+    for (; bit1 != blockEnd(); ++bit1, ++bit2) {
+        if (bit2.getError()) break;
         if (bit2 == blockEnd()) {
-            data = *bit1;
-            bool ret = data.allocate(header, record, iovcnt);
-            if (!ret) {
-                splitDataBlock(data.blockid());
-                insert(header, record, iovcnt);
-                data = *bit1;
-            }
+            ret = place(bit1, data, header, record, iovcnt);
             break;
         }
         data = *bit1;
+        if (bit1.getError()) break;
         if (data.getSlotsNum() == 0) continue;
 
+        // 只比较两个block头部的最小key，不解析记录；下一个block为空时不设上界
+        bool below2 = true;
         iovec key1, key2;
-        //获取key2字段
-        Record rec = *iterator(0, bit2);
-        rec.specialRef(key2, key);
-
-        //获取key1字段
-        data = *bit1;
-        rec = *iterator(0, bit1);
-        rec.specialRef(key1, key);
-
-        if (relationInfo->fields[key].type->compare(
+        data = *bit2;
+        if (bit2.getError()) break;
+        if (data.getLow(key, key2))
+            below2 = type->compare(
                 keyField.iov_base,
                 key2.iov_base,
                 keyField.iov_len,
-                key2.iov_len) &&
-            (relationInfo->fields[key].type->compare(
-                key1.iov_base,
-                keyField.iov_base,
-                key1.iov_len,
-                keyField.iov_len))) {
-            data = *bit1;
-            bool ret = data.allocate(header, record, iovcnt);
-            if (!ret) {
-                splitDataBlock(data.blockid());
-                insert(header, record, iovcnt);
-                data = *bit1;
-            }
+                key2.iov_len);
+        data = *bit1;
+        if (bit1.getError()) break;
+        data.getLow(key, key1);
+
+        if (below2 && type->compare(
+                          key1.iov_base,
+                          keyField.iov_base,
+                          key1.iov_len,
+                          keyField.iov_len)) {
+            ret = place(bit1, data, header, record, iovcnt);
             break;
         } else if (
-            relationInfo->fields[key].type->compare(
+            type->compare(
                 keyField.iov_base,
                 key1.iov_base,
                 keyField.iov_len,
                 key1.iov_len) &&
             bit1 == blockBegin()) {
-            data = *bit1;
-            bool ret = data.allocate(header, record, iovcnt);
-            if (!ret) {
-                splitDataBlock(data.blockid());
-                insert(header, record, iovcnt);
-                data = *bit1;
-            }
+            ret = place(bit1, data, header, record, iovcnt);
             break;
         }
     }
 
-    // TODO:更新schema
+    if (bit1.getError()) return bit1.getError();
+    if (bit2.getError()) return bit2.getError();
+    // place失败时没有持有latch
+    if (ret) return ret;
 
-    // 排序
-    std::vector<unsigned short> slotsv;
-    for (int i = 0; i < data.getSlotsNum(); i++)
-        slotsv.push_back(data.getSlot(i));
-    if (relationInfo->fields[key].type == NULL)
-        relationInfo->fields[key].type =
-            findDataType(relationInfo->fields[key].fieldType.c_str());
-    Compare cmp(relationInfo->fields[key], key, *this);
-    std::sort(slotsv.begin(), slotsv.end(), cmp);
-    for (int i = 0; i < data.getSlotsNum(); i++)
-        data.setSlot(i, slotsv[i]);
+    // TODO:更新schema
 
     // 处理checksum
     data.setChecksum();
+    page_->latch.unlock();
 
     //写block
     ret = writeBlock();
     if (ret) return ret;
-    return S_OK;
+    return commit();
+}
+
+int Table::get(
+    struct iovec keyField,
+    unsigned char *header,
+    struct iovec *record,
+    int iovcnt)
+{
+    int ret = initial();
+    if (ret) return ret;
+    DataBlock data;
+    unsigned int blockid, prev;
+    unsigned short slotid;
+    ret = locate(keyField, data, blockid, prev, slotid);
+    if (ret) return ret;
+
+    // 映射模式下data是映射视图，不用latch
+    Frame *page = relationInfo->file.mapped() ? NULL : page_;
+    if (page) page->latch.lockShared();
+    Record rec;
+    unsigned short offset = data.getSlot(slotid);
+    rec.attach(data.buffer() + offset, blockSize_ - offset);
+    bool ok = rec.get(record, iovcnt, header);
+    if (page) page->latch.unlockShared();
+    return ok ? S_OK : EINVAL;
 }
 
 int Table::remove(struct iovec keyField)
 {
+    // 映射模式只读
+    if (relationInfo->file.mapped()) return EROFS;
     //打开block
-    bool ret = initial();
+    int ret = initial();
     if (ret) return ret;
-    unsigned int key = relationInfo->key;
     DataBlock data;
-    int blockid;
-    auto bit = blockBegin();
-    for (; bit != blockEnd(); ++bit) {
+    unsigned int blockid;
+    unsigned int prev; // 前驱blockid，0表示链头
+    unsigned short slotid;
+    ret = locate(keyField, data, blockid, prev, slotid);
+    if (ret) return ret;
+
+    //删除slot，记录空间留给之后的插入
+    page_->latch.lock();
+    data.remove(relationInfo->key, slotid);
+    // 处理checksum
+    data.setChecksum();
+    page_->latch.unlock();
+
+    //写block，block空了则回收
+    if (data.getSlotsNum() == 0)
+        ret = freeBlock(blockid, prev);
+    else
+        ret = writeBlock();
+    if (ret) return ret;
+    return commit();
+}
+
+DataType *Table::keyType()
+{
+    FieldInfo &field = relationInfo->fields[relationInfo->key];
+    if (field.type == NULL) field.type = findDataType(field.fieldType.c_str());
+    return field.type;
+}
+
+int Table::locate(
+    struct iovec keyField,
+    DataBlock &data,
+    unsigned int &blockid,
+    unsigned int &prev,
+    unsigned short &slotid)
+{
+    unsigned int key = relationInfo->key;
+    DataType *type = keyType();
+    prev = 0;
+    blockIter bit = blockBegin();
+    for (; bit != blockEnd(); prev = bit.getBlockid(), ++bit) {
         data = *bit;
-        if (data.getSlotsNum() == 0) continue;
+        if (bit.getError()) return bit.getError();
+        unsigned short slots = data.getSlotsNum();
+        if (slots == 0) continue;
 
+        // 只比较头部的最小、最大key，不在[low, high]中则看下一个block
         iovec keyFront, keyBack;
-        Record recFront = front(bit);
-        recFront.specialRef(keyFront, key);
-        Record reckBack = back(bit);
-        reckBack.specialRef(keyBack, key);
-        if (!relationInfo->fields[key].type->compare(
+        data.getLow(key, keyFront);
+        data.getHigh(key, keyBack);
+        if (type->compare(
                 keyField.iov_base,
                 keyFront.iov_base,
                 keyField.iov_len,
-                keyFront.iov_len) &&
-            !relationInfo->fields[key].type->compare(
+                keyFront.iov_len) ||
+            type->compare(
                 keyBack.iov_base,
                 keyField.iov_base,
                 keyBack.iov_len,
-                keyField.iov_len)) {
-            blockid = bit.getBlockid();
-            break;
-        }
-    }
-    if (bit == blockEnd()) return S_FALSE;
-    //读block.slots[]
-    data.attach(buffer_);
-    std::vector<unsigned short> slotsv;
-    for (int i = 0; i < data.getSlotsNum(); i++)
-        slotsv.push_back(data.getSlot(i));
-
-    unsigned short slotid = -1;
-
-    //如果record.key在正范围，则在block中查找
-    for (auto iter = begin(bit); iter != end(bit); ++iter) {
-        Record &record = *iter;
-        iovec field;
-        unsigned int key = relationInfo->key;
-        record.specialRef(field, key);
-        if (!(relationInfo->fields[key].type->compare(
-                field.iov_base,
-                keyField.iov_base,
-                field.iov_len,
-                keyField.iov_len)) &&
-            !(relationInfo->fields[key].type->compare(
-                keyField.iov_base,
-                field.iov_base,
-                keyField.iov_len,
-                field.iov_len))) {
-            slotid = iter.getSlotid();
-        }
-    }
-    if (slotid == -1) return S_FALSE;
-    // TODO:garbage pointer
-
-    //删除slots
-    auto eraseIt = slotsv.begin() + slotid;
-    slotsv.erase(eraseIt);
+                keyField.iov_len))
+            continue;
 
-    data.setSlotsNum(data.getSlotsNum() - 1);
-    for (int i = 0; i < data.getSlotsNum(); i++)
-        data.setSlot(i, slotsv[i]);
-
-    // 处理checksum
-    data.setChecksum();
-
-    //写block
-    ret = writeBlock();
-    if (ret) return ret;
-    return S_OK;
+        // block内二分查找
+        bool found;
+        slotid = data.search(key, type, keyField, found);
+        if (!found) return S_FALSE;
+        blockid = bit.getBlockid();
+        return S_OK;
+    }
+    // 取后继时读block失败也结束迭代
+    return bit.getError() ? bit.getError() : S_FALSE;
 }
+
 int Table::update(
     struct iovec keyField,
     const unsigned char *header,
@@ -373,6 +791,7 @@ int Table::update(
     int iovcnt)
 {
     int ret;
+    // remove按key定位旧记录，找不到时返回S_FALSE
     ret = remove(keyField);
     if (ret) return ret;
     ret = insert(header, record, iovcnt);
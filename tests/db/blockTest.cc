@@ -8,6 +8,8 @@
 #include "../catch.hpp"
 #include <db/block.h>
 #include <db/record.h>
+#include <string>
+#include <vector>
 using namespace db;
 
 TEST_CASE("db/block.h")
@@ -157,4 +159,308 @@ TEST_CASE("db/block.h")
         REQUIRE(f2 >= (unsigned short) ret.first);
         REQUIRE(f2 % 8 == 0);
     }
-}
\ No newline at end of file
+
+    SECTION("search")
+    {
+        DataBlock data;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        data.attach(buffer);
+        data.clear(1);
+
+        // key为10、20、...、100，按顺序分配，slots[]有序
+        for (long long k = 10; k <= 100; k += 10) {
+            struct iovec iov[2];
+            iov[0].iov_base = &k;
+            iov[0].iov_len = sizeof(k);
+            const char *hello = "hello";
+            iov[1].iov_base = (void *) hello;
+            iov[1].iov_len = strlen(hello) + 1;
+            unsigned char header = 0;
+            REQUIRE(data.allocate(&header, iov, 2));
+        }
+        REQUIRE(data.getSlotsNum() == 10);
+
+        DataType *type = findDataType("BIGINT");
+        REQUIRE(type != NULL);
+        bool found;
+        long long k = 50;
+        struct iovec key = {&k, sizeof(k)};
+        REQUIRE(data.search(0, type, key, found) == 4);
+        REQUIRE(found);
+        k = 55;
+        REQUIRE(data.search(0, type, key, found) == 5);
+        REQUIRE(!found);
+        k = 5;
+        REQUIRE(data.search(0, type, key, found) == 0);
+        REQUIRE(!found);
+        k = 200;
+        REQUIRE(data.search(0, type, key, found) == 10);
+        REQUIRE(!found);
+
+        // 删除slot，之后的前移
+        data.eraseSlot(4);
+        REQUIRE(data.getSlotsNum() == 9);
+        k = 50;
+        REQUIRE(data.search(0, type, key, found) == 4);
+        REQUIRE(!found);
+        k = 100;
+        REQUIRE(data.search(0, type, key, found) == 8);
+        REQUIRE(found);
+        iovec field;
+        REQUIRE(data.getKey(4, 0, field));
+        REQUIRE(*(long long *) field.iov_base == 60);
+    }
+
+    SECTION("insert")
+    {
+        DataBlock data;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        data.attach(buffer);
+        data.clear(1);
+        DataType *type = findDataType("BIGINT");
+        REQUIRE(type != NULL);
+
+        // 乱序插入，slots[]始终有序
+        long long keys[] = {50, 10, 90, 30, 70, 20, 80, 40, 60, 100, 5};
+        int count = sizeof(keys) / sizeof(keys[0]);
+        for (int i = 0; i < count; ++i) {
+            struct iovec iov[2];
+            iov[0].iov_base = &keys[i];
+            iov[0].iov_len = sizeof(long long);
+            const char *hello = "hello";
+            iov[1].iov_base = (void *) hello;
+            iov[1].iov_len = strlen(hello) + 1;
+            unsigned char header = 0;
+            REQUIRE(data.insert(0, type, &header, iov, 2));
+        }
+        REQUIRE(data.getSlotsNum() == count);
+        long long prev = 0;
+        for (unsigned short i = 0; i < data.getSlotsNum(); ++i) {
+            iovec field;
+            REQUIRE(data.getKey(i, 0, field));
+            long long k = *(long long *) field.iov_base;
+            REQUIRE(k > prev);
+            prev = k;
+        }
+
+        // 指定位置插入
+        long long k = 1;
+        struct iovec iov[1] = {{&k, sizeof(k)}};
+        unsigned char header = 0;
+        REQUIRE(data.allocate(&header, iov, 1, 0));
+        iovec field;
+        REQUIRE(data.getKey(0, 0, field));
+        REQUIRE(*(long long *) field.iov_base == 1);
+        REQUIRE(data.getKey(1, 0, field));
+        REQUIRE(*(long long *) field.iov_base == 5);
+    }
+
+    SECTION("garbage")
+    {
+        DataBlock data;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        data.attach(buffer);
+        data.clear(1);
+        DataType *type = findDataType("BIGINT");
+        REQUIRE(type != NULL);
+
+        // 插满，每条记录带100B的字段
+        char pad[256];
+        ::memset(pad, 'x', sizeof(pad));
+        auto put = [&](long long k, size_t len) {
+            struct iovec iov[2];
+            iov[0].iov_base = &k;
+            iov[0].iov_len = sizeof(k);
+            iov[1].iov_base = pad;
+            iov[1].iov_len = len;
+            unsigned char header = 0;
+            return data.insert(0, type, &header, iov, 2);
+        };
+        long long n = 0;
+        while (put(n + 1, 100))
+            ++n;
+        REQUIRE(n > 100);
+        REQUIRE(data.getGarbageLength() == 0);
+
+        // 删除偶数key，空间进入空闲链表
+        for (unsigned short i = 1; i < data.getSlotsNum(); ++i)
+            data.deallocate(i);
+        REQUIRE(data.getSlotsNum() == (n + 1) / 2);
+        unsigned short garbage = data.getGarbageLength();
+        REQUIRE(garbage > 0);
+
+        // 同样大小的记录重用空闲空间，freespace不变
+        unsigned short freespace = data.getFreespace();
+        REQUIRE(put(2, 100));
+        REQUIRE(data.getFreespace() == freespace);
+        REQUIRE(data.getGarbageLength() < garbage);
+
+        // 单块空闲空间都放不下的记录，整理之后放入
+        REQUIRE(put(4, 250));
+        REQUIRE(data.getGarbageLength() == 0);
+
+        // 整理后记录完整，仍然有序
+        long long prev = 0;
+        for (unsigned short i = 0; i < data.getSlotsNum(); ++i) {
+            Record record;
+            record.attach(data.buffer() + data.getSlot(i), Block::BLOCK_SIZE);
+            iovec iov[2];
+            unsigned char header;
+            REQUIRE(record.ref(iov, 2, &header));
+            long long k = *(long long *) iov[0].iov_base;
+            REQUIRE(k > prev);
+            prev = k;
+            REQUIRE(iov[1].iov_len == (k == 4 ? 250u : 100u));
+        }
+    }
+
+    SECTION("fence")
+    {
+        DataBlock data;
+        unsigned char buffer[Block::BLOCK_SIZE];
+        data.attach(buffer);
+        data.clear(1);
+        DataType *type = findDataType("BIGINT");
+        REQUIRE(type != NULL);
+        iovec field;
+        REQUIRE(!data.getLow(0, field));
+        REQUIRE(!data.getHigh(0, field));
+
+        // 乱序插入，头部的最小、最大key随之更新
+        long long keys[] = {50, 10, 90, 30, 70};
+        for (int i = 0; i < 5; ++i) {
+            struct iovec iov[1] = {{&keys[i], sizeof(long long)}};
+            unsigned char header = 0;
+            REQUIRE(data.insert(0, type, &header, iov, 1));
+        }
+        REQUIRE(data.getLow(0, field));
+        REQUIRE(field.iov_base == buffer + DataBlock::DATA_LOW_OFFSET);
+        REQUIRE(*(long long *) field.iov_base == 10);
+        REQUIRE(data.getHigh(0, field));
+        REQUIRE(field.iov_base == buffer + DataBlock::DATA_HIGH_OFFSET);
+        REQUIRE(*(long long *) field.iov_base == 90);
+
+        // 删除两端的记录
+        data.remove(0, 0);
+        REQUIRE(data.getLow(0, field));
+        REQUIRE(*(long long *) field.iov_base == 30);
+        data.remove(0, data.getSlotsNum() - 1);
+        REQUIRE(data.getHigh(0, field));
+        REQUIRE(*(long long *) field.iov_base == 70);
+        data.remove(0, 1);
+        REQUIRE(data.getLow(0, field));
+        REQUIRE(*(long long *) field.iov_base == 30);
+        data.remove(0, 0);
+        data.remove(0, 0);
+        REQUIRE(data.getSlotsNum() == 0);
+        REQUIRE(!data.getLow(0, field));
+
+        // key太长时不存放，解析记录
+        DataType *chars = findDataType("CHAR");
+        REQUIRE(chars != NULL);
+        std::string big(100, 'k');
+        struct iovec iov[1] = {{(void *) big.c_str(), big.size() + 1}};
+        unsigned char header = 0;
+        REQUIRE(data.insert(0, chars, &header, iov, 1));
+        REQUIRE(data.getLow(0, field));
+        REQUIRE(field.iov_base != buffer + DataBlock::DATA_LOW_OFFSET);
+        REQUIRE(field.iov_len == big.size() + 1);
+        REQUIRE(::memcmp(field.iov_base, big.c_str(), field.iov_len) == 0);
+    }
+
+    SECTION("size")
+    {
+        REQUIRE(Block::validSize(4096));
+        REQUIRE(Block::validSize(Block::BLOCK_SIZE));
+        REQUIRE(Block::validSize(65536));
+        REQUIRE(!Block::validSize(2048));
+        REQUIRE(!Block::validSize(12288));
+        REQUIRE(!Block::validSize(131072));
+
+        // 同样的记录，容量随block大小增长
+        DataType *type = findDataType("BIGINT");
+        REQUIRE(type != NULL);
+        const unsigned int sizes[] = {4096, 65536};
+        unsigned short counts[2];
+        for (int n = 0; n < 2; ++n) {
+            std::vector<unsigned char> buffer(sizes[n]);
+            DataBlock data;
+            data.attach(&buffer[0], sizes[n]);
+            data.clear(1);
+            REQUIRE(data.size() == sizes[n]);
+            REQUIRE(
+                data.getFreeLength() == sizes[n] -
+                                            DataBlock::DATA_DEFAULT_FREESPACE -
+                                            Block::BLOCK_CHECKSUM_SIZE);
+            data.setChecksum();
+            REQUIRE(data.checksum());
+
+            // 倒序插入直到放满
+            long long key = 100000;
+            for (;; --key) {
+                struct iovec iov[2];
+                iov[0].iov_base = &key;
+                iov[0].iov_len = sizeof(long long);
+                std::string name(50, 's');
+                iov[1].iov_base = (void *) name.c_str();
+                iov[1].iov_len = name.size() + 1;
+                unsigned char header = 0;
+                if (!data.insert(0, type, &header, iov, 2)) break;
+            }
+            counts[n] = data.getSlotsNum();
+            for (unsigned short i = 0; i < counts[n]; ++i) {
+                iovec field;
+                REQUIRE(data.getKey(i, 0, field));
+                REQUIRE(*(long long *) field.iov_base == key + 1 + i);
+            }
+            data.setChecksum();
+            REQUIRE(data.checksum());
+            // 末尾的checksum被破坏
+            buffer[sizes[n] - 1] ^= 1;
+            REQUIRE(!data.checksum());
+
+            // 删除后重用空间
+            data.remove(0, 0);
+            long long k = 1;
+            struct iovec iov[1] = {{&k, sizeof(k)}};
+            unsigned char header = 0;
+            REQUIRE(data.insert(0, type, &header, iov, 1));
+        }
+        REQUIRE(counts[1] >= counts[0] * 16);
+    }
+
+    SECTION("crc32c")
+    {
+        std::vector<unsigned char> buffer(Block::BLOCK_SIZE);
+        DataBlock data;
+        data.attach(&buffer[0], Block::BLOCK_SIZE, CHECKSUM_CRC32C);
+        REQUIRE(data.algorithm() == CHECKSUM_CRC32C);
+        data.clear(1);
+        REQUIRE(data.checksum());
+
+        // trailer中按大端存放前面内容的CRC32C
+        long long key = 7;
+        struct iovec iov[1] = {{&key, sizeof(key)}};
+        unsigned char header = 0;
+        REQUIRE(data.insert(0, findDataType("BIGINT"), &header, iov, 1));
+        REQUIRE(!data.checksum());
+        data.setChecksum();
+        REQUIRE(data.checksum());
+        REQUIRE(
+            be32toh(data.getChecksum()) ==
+            crc32c(&buffer[0], Block::BLOCK_SIZE - Block::BLOCK_CHECKSUM_SIZE));
+        buffer[100] ^= 1;
+        REQUIRE(!data.checksum());
+        buffer[100] ^= 1;
+        buffer[Block::BLOCK_SIZE - 1] ^= 1;
+        REQUIRE(!data.checksum());
+
+        // 同一内容按32位和检验不通过
+        buffer[Block::BLOCK_SIZE - 1] ^= 1;
+        Block inet(&buffer[0]);
+        REQUIRE(inet.algorithm() == CHECKSUM_INET);
+        REQUIRE(!inet.checksum());
+        inet.setChecksum();
+        REQUIRE(inet.checksum());
+    }
+}
@@ -0,0 +1,921 @@
+////
+// @file bufferTest.cc
+// @brief
+// 测试缓冲池
+//
+// @author junix
+//
+#include "../catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <db/buffer.h>
+#include <db/block.h>
+using namespace db;
+
+TEST_CASE("db/buffer.h")
+{
+    SECTION("pin")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        BufferPool pool(4);
+
+        // 新block内容为0
+        Frame *frame;
+        ret = pool.pin(&file, 1, frame, PIN_NEW);
+        REQUIRE(ret == S_OK);
+        REQUIRE(frame->blockid == 1);
+        REQUIRE(frame->data[0] == 0);
+        REQUIRE(pool.stats().misses == 1);
+
+        // 修改后写回
+        ::memset(frame->data, 'a', Block::BLOCK_SIZE);
+        pool.markDirty(frame);
+        REQUIRE(frame->dirty);
+        ret = pool.flush(frame);
+        REQUIRE(ret == S_OK);
+        REQUIRE(!frame->dirty);
+        char buf[16];
+        file.read(Root::ROOT_SIZE, buf, sizeof(buf));
+        REQUIRE(buf[0] == 'a');
+
+        // 再次pin命中同一页面
+        Frame *again;
+        ret = pool.pin(&file, 1, again);
+        REQUIRE(ret == S_OK);
+        REQUIRE(again == frame);
+        REQUIRE(frame->pins == 2);
+        REQUIRE(pool.stats().hits == 1);
+        pool.unpin(again);
+        pool.unpin(frame);
+        REQUIRE(pool.lookup(&file, 1) == frame);
+        REQUIRE(pool.lookup(&file, 2) == NULL);
+        pool.unpin(frame);
+
+        REQUIRE(pool.drop(&file) == S_OK);
+        REQUIRE(pool.lookup(&file, 1) == NULL);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("evict")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        BufferPool pool(2);
+
+        // 脏页换出前写回
+        Frame *frames[3];
+        for (unsigned int i = 0; i < 2; ++i) {
+            ret = pool.pin(&file, i + 1, frames[i], PIN_NEW);
+            REQUIRE(ret == S_OK);
+            frames[i]->data[0] = (unsigned char) ('x' + i);
+            pool.markDirty(frames[i]);
+        }
+        REQUIRE(pool.size() == 2);
+
+        // 全部pin住时无法换出
+        ret = pool.pin(&file, 3, frames[2], PIN_NEW);
+        REQUIRE(ret == ENOMEM);
+
+        // 换出最久未用的block 1
+        pool.unpin(frames[0]);
+        pool.unpin(frames[1]);
+        ret = pool.pin(&file, 3, frames[2], PIN_NEW);
+        REQUIRE(ret == S_OK);
+        REQUIRE(pool.size() == 2);
+        REQUIRE(pool.stats().evictions == 1);
+        REQUIRE(pool.lookup(&file, 1) == NULL);
+        pool.unpin(frames[2]);
+
+        // 重新读入，内容来自写回的数据
+        Frame *frame;
+        ret = pool.pin(&file, 1, frame);
+        REQUIRE(ret == S_OK);
+        REQUIRE(frame->data[0] == 'x');
+        pool.unpin(frame);
+        pool.drop(&file);
+
+        // 写回后的脏页仍最先换出，2Q中不因影子队列提升到热队列
+        const int policies[] = {REPLACE_LRU, REPLACE_CLOCK, REPLACE_2Q};
+        for (int p = 0; p < 3; ++p) {
+            BufferPool full(8, policies[p], 1);
+            for (unsigned int id = 1; id <= 8; ++id) {
+                REQUIRE(full.pin(&file, id, frame, PIN_NEW) == S_OK);
+                if (id == 1) full.markDirty(frame);
+                full.unpin(frame);
+            }
+            REQUIRE(full.pin(&file, 9, frame, PIN_NEW) == S_OK);
+            full.unpin(frame);
+            REQUIRE(full.dirty() == 0);
+            REQUIRE(full.lookup(&file, 1) == NULL);
+            frame = full.lookup(&file, 2);
+            REQUIRE(frame != NULL);
+            full.unpin(frame);
+            full.drop(&file);
+        }
+
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("policy")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+
+        // 热点block 1、2反复访问，之后扫描20个block，只用一次
+        const int policies[] = {REPLACE_LRU, REPLACE_CLOCK, REPLACE_2Q};
+        for (int p = 0; p < 3; ++p) {
+            BufferPool pool(8, policies[p]);
+            REQUIRE(pool.policy() == policies[p]);
+            Frame *frame;
+            for (int round = 0; round < 3; ++round)
+                for (unsigned int id = 1; id <= 2; ++id) {
+                    REQUIRE(pool.pin(&file, id, frame) == S_OK);
+                    pool.unpin(frame);
+                }
+            for (unsigned int id = 100; id < 120; ++id) {
+                REQUIRE(pool.pin(&file, id, frame, PIN_ONCE) == S_OK);
+                pool.unpin(frame);
+            }
+            REQUIRE(pool.size() == 8);
+            for (unsigned int id = 1; id <= 2; ++id) {
+                frame = pool.lookup(&file, id);
+                REQUIRE(frame != NULL);
+                pool.unpin(frame);
+            }
+            pool.drop(&file);
+        }
+
+        // 2Q不标记只用一次也能抵抗扫描：换出后不久再次访问的block进入热队列
+        BufferPool pool(8, REPLACE_2Q);
+        Frame *frame;
+        for (unsigned int id = 1; id <= 10; ++id) {
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        for (unsigned int id = 1; id <= 2; ++id) {
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        for (unsigned int id = 100; id < 120; ++id) {
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        for (unsigned int id = 1; id <= 2; ++id) {
+            frame = pool.lookup(&file, id);
+            REQUIRE(frame != NULL);
+            pool.unpin(frame);
+        }
+
+        // 切换策略后页面保留
+        pool.setPolicy(REPLACE_CLOCK);
+        REQUIRE(pool.policy() == REPLACE_CLOCK);
+        REQUIRE(pool.size() == 8);
+        pool.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("writer")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        BufferPool pool(64);
+        REQUIRE(pool.setDirtyRatio(50, 10) == EINVAL);
+        REQUIRE(pool.setDirtyRatio(10, 50) == S_OK);
+
+        // root和40个block，修改后只标脏，不写文件
+        Frame *frame;
+        pool.pin(&file, 0, frame, PIN_NEW);
+        Root root;
+        root.attach(frame->data);
+        root.clear(BLOCK_TYPE_DATA);
+        TimeStamp stamp = root.getTimeStamp();
+        pool.markDirty(frame);
+        pool.unpin(frame);
+        for (unsigned int id = 1; id <= 40; ++id) {
+            pool.pin(&file, id, frame, PIN_NEW);
+            frame->latch.lock();
+            ::memset(frame->data, (int) id, Block::BLOCK_SIZE);
+            frame->latch.unlock();
+            pool.markDirty(frame);
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.dirty() == 41);
+        unsigned long long length;
+        file.length(length);
+        REQUIRE(length == 0);
+
+        // 超过上限，没有写回线程时由调用者写回到后台比例
+        ret = pool.throttle();
+        REQUIRE(ret == S_OK);
+        REQUIRE(pool.dirty() <= 6);
+        REQUIRE(pool.stats().throttles == 1);
+        // 未超过上限不等待
+        REQUIRE(pool.throttle() == S_OK);
+        REQUIRE(pool.stats().throttles == 1);
+
+        // 写回线程把脏页写到后台比例以下
+        for (unsigned int id = 1; id <= 20; ++id) {
+            pool.pin(&file, id, frame);
+            pool.markDirty(frame);
+            pool.unpin(frame);
+        }
+        ret = pool.startWriter(5, 0);
+        REQUIRE(ret == S_OK);
+        REQUIRE(pool.startWriter() == EEXIST);
+        for (int i = 0; i < 200 && pool.dirty() > 6; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        REQUIRE(pool.dirty() <= 6);
+        pool.stopWriter();
+        REQUIRE(!pool.writerRunning());
+
+        // 检查点写回全部脏页，root记下新的时戳
+        pool.pin(&file, 40, frame);
+        pool.markDirty(frame);
+        pool.unpin(frame);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        ret = pool.checkpoint(&file);
+        REQUIRE(ret == S_OK);
+        REQUIRE(pool.dirty() == 0);
+        REQUIRE(pool.stats().checkpoints == 1);
+        unsigned char rb[Root::ROOT_SIZE];
+        file.read(0, (char *) rb, Root::ROOT_SIZE);
+        root.attach(rb);
+        REQUIRE(root.getTimeStamp() > stamp);
+        char buf[Block::BLOCK_SIZE];
+        for (unsigned int id = 1; id <= 40; ++id) {
+            file.read(
+                (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                buf,
+                sizeof(buf));
+            REQUIRE(buf[Block::BLOCK_SIZE - 1] == (char) id);
+        }
+        // 没有脏页时不做
+        REQUIRE(pool.checkpoint(&file) == S_OK);
+        REQUIRE(pool.stats().checkpoints == 1);
+
+        pool.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("batch")
+    {
+        // 异步模式的文件，不相邻的脏页一次提交写回，内存段用线程池
+        const int modes[] = {0, OPEN_MEMORY};
+        for (int m = 0; m < 2; ++m) {
+            File file;
+            int ret = file.open("buffer.db", modes[m]);
+            REQUIRE(ret == S_OK);
+            REQUIRE(file.setAsync() == S_OK);
+            BufferPool pool(64);
+            Frame *frame;
+            for (unsigned int id = 1; id <= 40; id += 2) {
+                pool.pin(&file, id, frame, PIN_NEW);
+                frame->latch.lock();
+                ::memset(frame->data, (int) id, Block::BLOCK_SIZE);
+                frame->latch.unlock();
+                pool.markDirty(frame);
+                pool.unpin(frame);
+            }
+            REQUIRE(pool.dirty() == 20);
+            REQUIRE(pool.flush(&file) == S_OK);
+            REQUIRE(pool.dirty() == 0);
+            REQUIRE(pool.stats().writes == 20);
+            char buf[Block::BLOCK_SIZE];
+            for (unsigned int id = 1; id <= 40; id += 2) {
+                file.read(
+                    (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                    buf,
+                    sizeof(buf));
+                REQUIRE(buf[0] == (char) id);
+                REQUIRE(buf[Block::BLOCK_SIZE - 1] == (char) id);
+            }
+
+            pool.drop(&file);
+            file.close();
+            File::remove("buffer.db");
+        }
+    }
+
+    SECTION("warm")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        std::vector<unsigned char> block(Block::BLOCK_SIZE);
+        for (unsigned int id = 1; id <= 32; ++id) {
+            ::memset(&block[0], (int) id, block.size());
+            file.write(
+                (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                (const char *) &block[0],
+                block.size());
+        }
+
+        // 保存缓冲的block列表
+        BufferPool pool(64);
+        Frame *frame;
+        for (unsigned int id = 1; id <= 32; id += 2) {
+            pool.pin(&file, id, frame);
+            pool.unpin(frame);
+        }
+        std::vector<unsigned int> blocks;
+        pool.resident(&file, blocks);
+        REQUIRE(blocks.size() == 16);
+        REQUIRE(blocks[0] == 1);
+        REQUIRE(blocks[15] == 31);
+        ret = pool.dump(&file, "buffer.warm");
+        REQUIRE(ret == S_OK);
+
+        // 另一个缓冲池按列表一次读入
+        BufferPool other(64);
+        size_t count;
+        ret = other.restore(&file, "buffer.warm", &count);
+        REQUIRE(ret == S_OK);
+        REQUIRE(count == 16);
+        // 预热不改变文件的I/O模式
+        REQUIRE(!file.async());
+        REQUIRE(other.cached(&file, 31));
+        REQUIRE(!other.cached(&file, 2));
+        ret = other.pin(&file, 31, frame);
+        REQUIRE(ret == S_OK);
+        REQUIRE(frame->data[Block::BLOCK_SIZE - 1] == 31);
+        other.unpin(frame);
+        REQUIRE(other.stats().hits == 1);
+        // 已缓存的跳过
+        ret = other.restore(&file, "buffer.warm", &count);
+        REQUIRE(ret == S_OK);
+        REQUIRE(count == 0);
+
+        // 容量不足时只用空闲页面，不换出
+        BufferPool small(4);
+        ret = small.restore(&file, "buffer.warm", &count);
+        REQUIRE(ret == S_OK);
+        REQUIRE(count == 4);
+        REQUIRE(small.stats().evictions == 0);
+
+        // 较短的列表覆盖旧列表，不留下尾部；checksum按大端存放
+        ret = small.dump(&file, "buffer.warm");
+        REQUIRE(ret == S_OK);
+        unsigned long long length;
+        File list;
+        list.open("buffer.warm");
+        list.length(length);
+        REQUIRE(
+            length == BufferPool::WARM_HEADER_SIZE + 4 * sizeof(unsigned int));
+        unsigned char header[BufferPool::WARM_HEADER_SIZE + 16];
+        list.read(0, (char *) header, sizeof(header));
+        unsigned int check;
+        ::memcpy(&check, &header[8], sizeof(check));
+        REQUIRE(
+            be32toh(check) ==
+            checksum32(&header[BufferPool::WARM_HEADER_SIZE], 16));
+        BufferPool fresh(64);
+        ret = fresh.restore(&file, "buffer.warm", &count);
+        REQUIRE(ret == S_OK);
+        REQUIRE(count == 4);
+
+        // 损坏或不存在的列表忽略
+        list.write(BufferPool::WARM_HEADER_SIZE + 1, "x", 1);
+        list.close();
+        REQUIRE(other.restore(&file, "buffer.warm") == S_FALSE);
+        File::remove("buffer.warm");
+        REQUIRE(other.restore(&file, "buffer.warm") == S_FALSE);
+        // 不存在的列表不会被创建
+        File probe;
+        REQUIRE(probe.open("buffer.warm", OPEN_NOCREATE) == ENOENT);
+
+        pool.drop(&file);
+        other.drop(&file);
+        small.drop(&file);
+        fresh.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("shard")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        // 每个block的内容都是其blockid
+        std::vector<unsigned char> block(Block::BLOCK_SIZE);
+        for (unsigned int id = 1; id <= 256; ++id) {
+            ::memset(&block[0], (int) id, block.size());
+            file.write(
+                (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                (const char *) &block[0],
+                block.size());
+        }
+
+        // 自动分区
+        BufferPool big(4096);
+        REQUIRE(big.shards() == BufferPool::MAX_SHARDS);
+        BufferPool small(8);
+        REQUIRE(small.shards() == 1);
+
+        // 多线程pin同一组block，容量不足时并发换出、读入
+        BufferPool pool(128, REPLACE_CLOCK, 4);
+        REQUIRE(pool.shards() == 4);
+        std::atomic<int> errors(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.push_back(std::thread([&pool, &file, &errors, t]() {
+                unsigned int seed = t + 1;
+                for (int i = 0; i < 20000; ++i) {
+                    seed = seed * 1103515245 + 12345;
+                    unsigned int id = (seed >> 16) % 256 + 1;
+                    Frame *frame;
+                    if (pool.pin(&file, id, frame)) {
+                        ++errors;
+                        continue;
+                    }
+                    frame->latch.lockShared();
+                    if (frame->blockid != id ||
+                        frame->data[Block::BLOCK_SIZE - 1] !=
+                            (unsigned char) id)
+                        ++errors;
+                    frame->latch.unlockShared();
+                    pool.unpin(frame);
+                }
+            }));
+        for (size_t t = 0; t < threads.size(); ++t)
+            threads[t].join();
+        REQUIRE(errors == 0);
+        REQUIRE(pool.size() <= 128);
+        BufferStats stats = pool.stats();
+        REQUIRE(stats.hits + stats.misses == 80000);
+
+        pool.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("arena")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        std::vector<unsigned char> block(Block::BLOCK_SIZE, 0x5a);
+        for (unsigned int id = 1; id <= 16; ++id)
+            file.write(
+                (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                (const char *) &block[0],
+                block.size());
+
+        BufferPool pool(8, REPLACE_LRU, 1);
+        REQUIRE(pool.arena() == -1);
+        // 大页不可用时退回普通页，仍然成功
+        REQUIRE(pool.setArena(true) == S_OK);
+        int pages = pool.arena();
+        REQUIRE(pages >= PAGES_NORMAL);
+        REQUIRE(pages <= PAGES_HUGETLB);
+        REQUIRE(pool.setArena(false) == EBUSY);
+
+        // 页面内容在区域中，互不重叠，换出后重用
+        std::vector<unsigned char *> datas;
+        for (unsigned int id = 1; id <= 16; ++id) {
+            Frame *frame;
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            REQUIRE(((size_t) frame->data % File::IO_ALIGNMENT) == 0);
+            REQUIRE(frame->data[0] == 0x5a);
+            if (id <= 8) datas.push_back(frame->data);
+            pool.unpin(frame);
+        }
+        std::sort(datas.begin(), datas.end());
+        for (size_t i = 1; i < datas.size(); ++i)
+            REQUIRE(datas[i] - datas[i - 1] >= (long) Block::BLOCK_SIZE);
+        REQUIRE(datas.back() - datas.front() < 8 * (long) Block::BLOCK_SIZE);
+        REQUIRE(pool.size() == 8);
+
+        // 已有页面时不能再设区域
+        BufferPool used(8);
+        Frame *frame;
+        REQUIRE(used.pin(&file, 1, frame) == S_OK);
+        used.unpin(frame);
+        REQUIRE(used.setArena(true) == EBUSY);
+        REQUIRE(used.arena() == -1);
+
+        used.drop(&file);
+        pool.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("resize")
+    {
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        BufferPool pool(64, REPLACE_LRU, 1);
+        REQUIRE(pool.setArena(false) == S_OK);
+
+        // 64个页面，偶数block修改过
+        for (unsigned int id = 1; id <= 64; ++id) {
+            Frame *frame;
+            REQUIRE(pool.pin(&file, id, frame, PIN_NEW) == S_OK);
+            if (id % 2 == 0) {
+                frame->latch.lock();
+                frame->data[0] = (unsigned char) id;
+                frame->latch.unlock();
+                pool.markDirty(frame);
+            }
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.size() == 64);
+        REQUIRE(pool.dirty() == 32);
+
+        // 缩小时脏页先写回，pin住的页面unpin后释放
+        Frame *held;
+        REQUIRE(pool.pin(&file, 2, held) == S_OK);
+        REQUIRE(pool.setCapacity(8) == S_OK);
+        REQUIRE(pool.capacity() == 8);
+        REQUIRE(pool.size() <= 9);
+        REQUIRE(pool.lookup(&file, 1) == NULL);
+        REQUIRE(pool.stats().writes >= 24);
+        pool.unpin(held);
+        REQUIRE(pool.size() <= 8);
+        // block 2被pin住，仍是脏页
+        for (unsigned int id = 4; id <= 48; id += 2) {
+            unsigned char byte = 0;
+            file.read(
+                (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                (char *) &byte,
+                1);
+            REQUIRE(byte == (unsigned char) id);
+        }
+
+        // 放大后重新增长，重用区域中释放的位置
+        REQUIRE(pool.setCapacity(64) == S_OK);
+        for (unsigned int id = 1; id <= 64; ++id) {
+            Frame *frame;
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            if (id % 2 == 0) REQUIRE(frame->data[0] == (unsigned char) id);
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.size() == 64);
+
+        // 使用中反复调整容量
+        std::atomic<bool> stop(false);
+        std::atomic<int> errors(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.push_back(std::thread([&pool, &file, &stop, &errors, t]() {
+                unsigned int seed = t + 1;
+                while (!stop) {
+                    seed = seed * 1103515245 + 12345;
+                    unsigned int id = (seed >> 16) % 64 + 1;
+                    Frame *frame;
+                    if (pool.pin(&file, id, frame)) continue;
+                    frame->latch.lock();
+                    if (id % 2 == 0 && frame->data[0] != (unsigned char) id)
+                        ++errors;
+                    frame->data[1] = (unsigned char) t;
+                    frame->latch.unlock();
+                    pool.markDirty(frame);
+                    pool.unpin(frame);
+                }
+            }));
+        for (int i = 0; i < 50; ++i)
+            REQUIRE(pool.setCapacity(i % 2 ? 64 : 4) == S_OK);
+        stop = true;
+        for (size_t t = 0; t < threads.size(); ++t)
+            threads[t].join();
+        REQUIRE(errors == 0);
+        REQUIRE(pool.setCapacity(4) == S_OK);
+        REQUIRE(pool.size() <= 4);
+
+        pool.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+
+    SECTION("blocksize")
+    {
+        // 缺省大小和64KB的文件共用缓冲池
+        File small, big;
+        int ret = small.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        ret = big.open("bufferBig.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        const unsigned int size = Block::MAX_BLOCK_SIZE;
+        big.blockSize_ = size;
+        REQUIRE(blockSizeOf(&small) == Block::BLOCK_SIZE);
+        REQUIRE(blockSizeOf(&big) == size);
+        std::vector<unsigned char> block(size);
+        for (unsigned int id = 1; id <= 4; ++id) {
+            ::memset(&block[0], (int) id, size);
+            big.write(
+                (id - 1) * size + Root::ROOT_SIZE,
+                (const char *) &block[0],
+                block.size());
+        }
+
+        BufferPool pool(2, REPLACE_LRU, 1);
+        REQUIRE(pool.setArena(false) == S_OK);
+        Frame *frame;
+        for (unsigned int id = 1; id <= 2; ++id) {
+            REQUIRE(pool.pin(&small, id, frame, PIN_NEW) == S_OK);
+            REQUIRE(frame->size == Block::BLOCK_SIZE);
+            pool.unpin(frame);
+        }
+
+        // 换出区域中的页面，换成足够大的buffer，按block大小读入
+        for (unsigned int id = 1; id <= 4; ++id) {
+            REQUIRE(pool.pin(&big, id, frame) == S_OK);
+            REQUIRE(frame->size >= size);
+            REQUIRE(frame->data[0] == id);
+            REQUIRE(frame->data[size - 1] == id);
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.size() == 2);
+
+        // 按block大小写回
+        REQUIRE(pool.pin(&big, 3, frame) == S_OK);
+        ::memset(frame->data, 'z', size);
+        pool.markDirty(frame);
+        REQUIRE(pool.flush(frame) == S_OK);
+        pool.unpin(frame);
+        unsigned char tail[2];
+        big.read(2 * size + Root::ROOT_SIZE + size - 2, (char *) tail, 2);
+        REQUIRE(tail[0] == 'z');
+        REQUIRE(tail[1] == 'z');
+        big.read(3 * size + Root::ROOT_SIZE, (char *) tail, 2);
+        REQUIRE(tail[0] == 4);
+
+        // 大页面可以直接重用于小block
+        REQUIRE(pool.pin(&small, 1, frame) == S_OK);
+        REQUIRE(frame->size >= Block::BLOCK_SIZE);
+        pool.unpin(frame);
+
+        pool.drop(&big);
+        pool.drop(&small);
+        big.close();
+        small.close();
+        File::remove("bufferBig.db");
+        File::remove("buffer.db");
+    }
+
+    SECTION("verify")
+    {
+        // 10个block，第5个损坏
+        File file;
+        int ret = file.open("buffer.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        file.algorithm_ = CHECKSUM_CRC32C;
+        std::vector<unsigned char> buffer(Block::BLOCK_SIZE);
+        for (unsigned int id = 1; id <= 10; ++id) {
+            DataBlock data;
+            data.attach(&buffer[0], Block::BLOCK_SIZE, CHECKSUM_CRC32C);
+            data.clear(id);
+            data.setChecksum();
+            if (id == 5) buffer[100] ^= 1;
+            file.write(
+                (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                (const char *) &buffer[0],
+                buffer.size());
+        }
+
+        BufferPool pool(4, REPLACE_LRU, 1);
+        REQUIRE(pool.verifyPolicy() == VERIFY_FIRST);
+        REQUIRE(pool.setVerify(4) == EINVAL);
+        REQUIRE(pool.setVerify(VERIFY_SAMPLED, 0) == EINVAL);
+
+        // 每次读入都检验，命中时不检验
+        REQUIRE(pool.setVerify(VERIFY_ALWAYS) == S_OK);
+        Frame *frame;
+        for (unsigned int id = 1; id <= 4; ++id) {
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.stats().verifies == 4);
+        REQUIRE(pool.pin(&file, 1, frame) == S_OK);
+        pool.unpin(frame);
+        REQUIRE(pool.stats().verifies == 4);
+        REQUIRE(pool.pin(&file, 5, frame) == EIO);
+        REQUIRE(pool.stats().corruptions == 1);
+        REQUIRE(pool.lookup(&file, 5) == NULL);
+        REQUIRE(pool.pin(&file, 5, frame) == EIO);
+        REQUIRE(pool.stats().corruptions == 2);
+        // 不检验时可以读
+        REQUIRE(pool.pin(&file, 5, frame, PIN_NOVERIFY) == S_OK);
+        pool.unpin(frame);
+        pool.drop(&file);
+
+        // 驻留期间只检验一次，换出后重新读入再检验；损坏的block每次都检验
+        REQUIRE(pool.setVerify(VERIFY_FIRST) == S_OK);
+        unsigned long long before = pool.stats().verifies;
+        for (unsigned int id = 1; id <= 4; ++id) {
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.stats().verifies == before + 4);
+        for (unsigned int round = 0; round < 2; ++round)
+            for (unsigned int id = 1; id <= 10; ++id) {
+                if (id == 5) continue;
+                REQUIRE(pool.pin(&file, id, frame) == S_OK);
+                pool.unpin(frame);
+            }
+        REQUIRE(pool.stats().verifies == before + 4 + 5 + 9);
+        REQUIRE(pool.pin(&file, 5, frame) == EIO);
+        REQUIRE(pool.pin(&file, 5, frame) == EIO);
+        REQUIRE(pool.stats().corruptions == 4);
+        // 文件关闭后重新检验
+        pool.drop(&file);
+        REQUIRE(pool.pin(&file, 1, frame) == S_OK);
+        pool.unpin(frame);
+        REQUIRE(pool.stats().verifies == before + 4 + 5 + 9 + 2 + 1);
+        pool.drop(&file);
+
+        // 抽样
+        REQUIRE(pool.setVerify(VERIFY_SAMPLED, 3) == S_OK);
+        before = pool.stats().verifies;
+        for (unsigned int id = 1; id <= 10; ++id) {
+            if (id == 5) continue;
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        REQUIRE(pool.stats().verifies == before + 3);
+        pool.drop(&file);
+
+        // 预热读入的block同样检验，损坏的不留在缓冲中
+        REQUIRE(pool.setVerify(VERIFY_ALWAYS) == S_OK);
+        before = pool.stats().corruptions;
+        std::vector<unsigned int> blocks;
+        blocks.push_back(4);
+        blocks.push_back(5);
+        blocks.push_back(6);
+        pool.warm(&file, blocks);
+        REQUIRE(pool.stats().corruptions == before + 1);
+        REQUIRE(pool.cached(&file, 4));
+        REQUIRE(!pool.cached(&file, 5));
+        pool.drop(&file);
+
+        // 调用者读入的页面，填好之前其它pin等待
+        REQUIRE(pool.pin(&file, 5, frame, PIN_FILL) == S_OK);
+        file.read(
+            4 * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+            (char *) frame->data,
+            Block::BLOCK_SIZE);
+        REQUIRE(pool.filled(frame, S_OK, Block::BLOCK_SIZE) == EIO);
+        pool.unpin(frame);
+        REQUIRE(!pool.cached(&file, 5));
+        REQUIRE(pool.pin(&file, 6, frame, PIN_FILL) == S_OK);
+        unsigned char *expect = new unsigned char[Block::BLOCK_SIZE];
+        file.read(
+            5 * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+            (char *) expect,
+            Block::BLOCK_SIZE);
+        bool same = false;
+        int got = EINVAL;
+        std::thread reader([&]() {
+            Frame *other;
+            got = pool.pin(&file, 6, other);
+            if (got) return;
+            same = ::memcmp(other->data, expect, Block::BLOCK_SIZE) == 0;
+            pool.unpin(other);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ::memcpy(frame->data, expect, Block::BLOCK_SIZE);
+        REQUIRE(pool.filled(frame, S_OK, Block::BLOCK_SIZE) == S_OK);
+        reader.join();
+        REQUIRE(got == S_OK);
+        REQUIRE(same);
+        pool.unpin(frame);
+        // 已在缓冲中时不用填写
+        REQUIRE(pool.pin(&file, 6, frame, PIN_FILL) == S_FALSE);
+        REQUIRE(::memcmp(frame->data, expect, Block::BLOCK_SIZE) == 0);
+        pool.unpin(frame);
+        delete[] expect;
+        pool.drop(&file);
+
+        // 关闭检验，或者文件没有设定算法
+        before = pool.stats().verifies;
+        REQUIRE(pool.setVerify(VERIFY_OFF) == S_OK);
+        REQUIRE(pool.pin(&file, 5, frame) == S_OK);
+        pool.unpin(frame);
+        pool.drop(&file);
+        REQUIRE(pool.setVerify(VERIFY_ALWAYS) == S_OK);
+        file.algorithm_ = -1;
+        REQUIRE(pool.pin(&file, 5, frame) == S_OK);
+        pool.unpin(frame);
+        REQUIRE(pool.stats().verifies == before);
+
+        pool.drop(&file);
+        file.close();
+        File::remove("buffer.db");
+    }
+}
+
+// 性能测试，缺省不运行，utest "[.bench]"
+TEST_CASE("db/buffer.h/bench", "[.bench]")
+{
+    File file;
+    int ret = file.open("bufferBench.db", OPEN_MEMORY);
+    REQUIRE(ret == S_OK);
+    std::vector<unsigned char> block(Block::BLOCK_SIZE);
+    for (unsigned int id = 1; id <= 512; ++id)
+        file.write(
+            (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+            (const char *) &block[0],
+            block.size());
+
+    // 全部驻留，只测pin/unpin的开销，对比单分区和自动分区
+    const int ops = 200000;
+    for (int sharded = 0; sharded < 2; ++sharded) {
+        BufferPool pool(1024, REPLACE_LRU, sharded ? 0 : 1);
+        for (unsigned int threads = 1; threads <= 8; threads *= 2) {
+            std::vector<std::thread> workers;
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (unsigned int t = 0; t < threads; ++t)
+                workers.push_back(std::thread([&pool, &file, t, ops]() {
+                    unsigned int seed = t + 1;
+                    for (int i = 0; i < ops; ++i) {
+                        seed = seed * 1103515245 + 12345;
+                        Frame *frame;
+                        if (pool.pin(&file, (seed >> 16) % 512 + 1, frame))
+                            continue;
+                        pool.unpin(frame);
+                    }
+                }));
+            for (size_t t = 0; t < workers.size(); ++t)
+                workers[t].join();
+            double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+            printf(
+                "shards=%-2u threads=%u %.2f Mops/s\n",
+                pool.shards(),
+                threads,
+                ops * threads / seconds / 1e6);
+        }
+        pool.drop(&file);
+    }
+    file.close();
+    File::remove("bufferBench.db");
+}
+
+// 大页区域的性能测试，缺省不运行，utest "[.bench]"
+TEST_CASE("db/buffer.h/arena", "[.bench]")
+{
+    // 8192个页面共128MB，随机访问时普通页的TLB覆盖不了
+    const unsigned int frames = 8192;
+    File file;
+    int ret = file.open("bufferArena.db", OPEN_MEMORY);
+    REQUIRE(ret == S_OK);
+    std::vector<unsigned char> block(Block::BLOCK_SIZE, 1);
+    for (unsigned int id = 1; id <= frames; ++id)
+        file.write(
+            (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+            (const char *) &block[0],
+            block.size());
+
+    // 全部驻留，随机pin后读页面中的一个字节，对比逐个分配和大页区域
+    const int ops = 2000000;
+    for (int huge = 0; huge < 2; ++huge) {
+        // 按hash分区不均匀，留出余量保证全部驻留
+        BufferPool pool(frames * 2);
+        if (huge) REQUIRE(pool.setArena(true) == S_OK);
+        for (unsigned int id = 1; id <= frames; ++id) {
+            Frame *frame;
+            REQUIRE(pool.pin(&file, id, frame) == S_OK);
+            pool.unpin(frame);
+        }
+        unsigned int seed = 1;
+        unsigned long long sum = 0, found = 0;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (int i = 0; i < ops; ++i) {
+            seed = seed * 1103515245 + 12345;
+            Frame *frame = pool.lookup(&file, (seed >> 8) % frames + 1);
+            if (frame == NULL) continue;
+            ++found;
+            sum += frame->data[(seed >> 3) % Block::BLOCK_SIZE];
+            pool.unpin(frame);
+        }
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        printf(
+            "arena=%-2d %.2f Mops/s\n",
+            huge ? pool.arena() : -1,
+            ops / seconds / 1e6);
+        REQUIRE(sum == found);
+        pool.drop(&file);
+    }
+    file.close();
+    File::remove("bufferArena.db");
+}
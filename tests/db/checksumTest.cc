@@ -7,6 +7,9 @@
 //
 #include "../catch.hpp"
 #include <string.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
 #include <db/checksum.h>
 using namespace db;
 
@@ -25,4 +28,112 @@ TEST_CASE("db/checksum.h")
         sum32 = checksum32(buf, 4096);
         REQUIRE(sum32 == 0);
     }
-}
\ No newline at end of file
+
+    SECTION("simd")
+    {
+        // 各指令集的实现与逐字节实现完全相同，包括未对齐的首尾和溢出
+        std::vector<unsigned char> data(70000);
+        unsigned int seed = 7;
+        for (size_t i = 0; i < data.size(); ++i) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (unsigned char) (seed >> 16);
+        }
+        int top = checksum32Simd();
+        REQUIRE(top >= SIMD_SCALAR);
+        REQUIRE(top <= SIMD_AVX2);
+        for (int simd = SIMD_SCALAR; simd <= top; ++simd) {
+            for (size_t offset = 0; offset < 32; ++offset)
+                for (int len = 0; len < 300; ++len)
+                    REQUIRE(
+                        checksum32With(simd, &data[offset], len) ==
+                        checksum32Scalar(&data[offset], len));
+            for (int len = 16384; len <= 65536; len *= 2) {
+                REQUIRE(
+                    checksum32With(simd, &data[1], len) ==
+                    checksum32Scalar(&data[1], len));
+                std::vector<unsigned char> ones(len, 0xff);
+                REQUIRE(
+                    checksum32With(simd, &ones[0], len) ==
+                    checksum32Scalar(&ones[0], len));
+            }
+        }
+        REQUIRE(checksum32(&data[5], 1000) == checksum32Scalar(&data[5], 1000));
+    }
+    SECTION("crc32c")
+    {
+        // RFC 3720的测试向量
+        const char *digits = "123456789";
+        REQUIRE(crc32c((const unsigned char *) digits, 9) == 0xe3069283);
+        REQUIRE(
+            crc32cSoftware((const unsigned char *) digits, 9) == 0xe3069283);
+        unsigned char buf[64];
+        memset(buf, 0, 32);
+        REQUIRE(crc32c(buf, 32) == 0x8a9136aa);
+        memset(buf, 0xff, 32);
+        REQUIRE(crc32c(buf, 32) == 0x62a8ab43);
+        for (int i = 0; i < 32; ++i)
+            buf[i] = (unsigned char) i;
+        REQUIRE(crc32c(buf, 32) == 0x46dd794e);
+        REQUIRE(crc32c(buf, 0) == 0);
+
+        // 硬件与软件实现在各种长度、对齐下一致，可以分段计算
+        std::vector<unsigned char> data(4096 + 16);
+        unsigned int seed = 1;
+        for (size_t i = 0; i < data.size(); ++i) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (unsigned char) (seed >> 16);
+        }
+        for (size_t offset = 0; offset < 8; ++offset)
+            for (size_t len = 0; len < 100; ++len)
+                REQUIRE(
+                    crc32c(&data[offset], len) ==
+                    crc32cSoftware(&data[offset], len));
+        unsigned int whole = crc32c(&data[3], 4096);
+        REQUIRE(whole == crc32cSoftware(&data[3], 4096));
+        REQUIRE(crc32c(&data[3 + 1000], 3096, crc32c(&data[3], 1000)) == whole);
+        REQUIRE(
+            crc32cSoftware(&data[3 + 7], 4089, crc32cSoftware(&data[3], 7)) ==
+            whole);
+    }
+}
+
+// checksum吞吐量，缺省不运行，utest "[.bench]"
+TEST_CASE("db/checksum.h/bench", "[.bench]")
+{
+    const size_t size = 16 * 1024;
+    const int rounds = 20000;
+    std::vector<unsigned char> block(size);
+    for (size_t i = 0; i < size; ++i)
+        block[i] = (unsigned char) (i * 131);
+
+    const char *names[] = {
+        "checksum32Scalar", "checksum32", "crc32cSoftware", "crc32c"};
+    for (int n = 0; n < 4; ++n) {
+        unsigned int sum = 0;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i) {
+            block[0] = (unsigned char) i;
+            if (n == 0)
+                sum += checksum32Scalar(&block[0], (int) size);
+            else if (n == 1)
+                sum += checksum32(&block[0], (int) size);
+            else if (n == 2)
+                sum += crc32cSoftware(&block[0], size);
+            else
+                sum += crc32c(&block[0], size);
+        }
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+        printf(
+            "%-17s %.2f GB/s (%x)\n",
+            names[n],
+            (double) size * rounds / seconds / 1e9,
+            sum);
+    }
+    printf(
+        "checksum32 simd: %d, crc32c hardware: %s\n",
+        checksum32Simd(),
+        crc32cHardware() ? "yes" : "no");
+}
@@ -6,7 +6,10 @@
 // @email niexiaowen@uestc.edu.cn
 //
 #include "../catch.hpp"
+#include <thread>
+#include <vector>
 #include <db/file.h>
+#include <db/aio.h>
 using namespace db;
 
 TEST_CASE("db/file.h")
@@ -67,6 +70,306 @@ TEST_CASE("db/file.h")
         file.close();
     }
 
+    SECTION("bytes")
+    {
+        File file;
+        file.open("table.db");
+
+        // 写返回实际长度
+        size_t bytes = 0;
+        int ret = file.write(0, hello, strlen(hello), &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == strlen(hello));
+
+        // 跨越文件尾读，返回截断后的长度
+        char buffer[64];
+        ret = file.read(4, buffer, sizeof(buffer), &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == strlen(hello) - 4);
+        REQUIRE(strncmp(buffer, hello + 4, bytes) == 0);
+
+        file.close();
+    }
+
+    SECTION("vector")
+    {
+        File file;
+        file.open("table.db");
+
+        // 聚集写两段
+        char a[100], b[300];
+        memset(a, 'a', sizeof(a));
+        memset(b, 'b', sizeof(b));
+        struct iovec iov[2];
+        iov[0].iov_base = a;
+        iov[0].iov_len = sizeof(a);
+        iov[1].iov_base = b;
+        iov[1].iov_len = sizeof(b);
+        size_t bytes = 0;
+        int ret = file.writev(0, iov, 2, &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == sizeof(a) + sizeof(b));
+
+        // 以不同的分段方式分散读回
+        char c[250], d[250];
+        iov[0].iov_base = c;
+        iov[0].iov_len = sizeof(c);
+        iov[1].iov_base = d;
+        iov[1].iov_len = sizeof(d);
+        ret = file.readv(0, iov, 2, &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == sizeof(a) + sizeof(b)); // 文件尾截断
+        REQUIRE(memcmp(c, a, sizeof(a)) == 0);
+        REQUIRE(memcmp(c + sizeof(a), b, sizeof(c) - sizeof(a)) == 0);
+        REQUIRE(memcmp(d, b, sizeof(a) + sizeof(b) - sizeof(c)) == 0);
+
+        file.close();
+    }
+
+    SECTION("direct")
+    {
+        File file;
+        int ret = file.open("direct.db", OPEN_DIRECT);
+        REQUIRE(ret == S_OK);
+
+        // buffer、偏移量、长度都按4KB对齐
+        char *wbuf = (char *) alignedAlloc(2 * File::IO_ALIGNMENT);
+        char *rbuf = (char *) alignedAlloc(2 * File::IO_ALIGNMENT);
+        REQUIRE(((size_t) wbuf & (File::IO_ALIGNMENT - 1)) == 0);
+        memset(wbuf, 'x', 2 * File::IO_ALIGNMENT);
+        ret = file.write(File::IO_ALIGNMENT, wbuf, 2 * File::IO_ALIGNMENT);
+        REQUIRE(ret == S_OK);
+
+        size_t bytes = 0;
+        ret = file.read(
+            File::IO_ALIGNMENT, rbuf, 2 * File::IO_ALIGNMENT, &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == 2 * File::IO_ALIGNMENT);
+        REQUIRE(memcmp(wbuf, rbuf, 2 * File::IO_ALIGNMENT) == 0);
+
+        alignedFree(wbuf);
+        alignedFree(rbuf);
+        file.close();
+        REQUIRE(File::remove("direct.db") == S_OK);
+    }
+
+    SECTION("durability")
+    {
+        File file;
+        file.open("table.db");
+
+        // 不刷盘时不计数
+        int ret = file.commit();
+        REQUIRE(ret == S_OK);
+        REQUIRE(file.syncStats().commits == 0);
+
+        // 每次提交都刷盘
+        ret = file.setDurability(DURABILITY_SYNC);
+        REQUIRE(ret == S_OK);
+        for (int i = 0; i < 3; ++i) {
+            file.write(i, hello, 1);
+            REQUIRE(file.commit() == S_OK);
+        }
+        SyncStats stats = file.syncStats();
+        REQUIRE(stats.commits == 3);
+        REQUIRE(stats.flushes == 3);
+
+        // 组提交，并发提交者共享刷盘
+        const int threads = 8;
+        const int rounds = 20;
+        ret = file.setDurability(DURABILITY_GROUP, 20000, threads);
+        REQUIRE(ret == S_OK);
+        std::vector<std::thread> workers;
+        std::vector<int> results(threads, S_OK);
+        for (int t = 0; t < threads; ++t)
+            workers.push_back(std::thread([&file, &results, hello, t] {
+                for (int i = 0; i < rounds; ++i) {
+                    file.write(t, hello, 1);
+                    int r = file.commit();
+                    if (r) results[t] = r;
+                }
+            }));
+        for (int t = 0; t < threads; ++t)
+            workers[t].join();
+        for (int t = 0; t < threads; ++t)
+            REQUIRE(results[t] == S_OK);
+        stats = file.syncStats();
+        REQUIRE(stats.commits == threads * rounds);
+        REQUIRE(stats.flushes < stats.commits);
+        REQUIRE(stats.maxBatch > 1);
+        REQUIRE(stats.maxBatch <= (unsigned int) threads);
+
+        file.close();
+    }
+
+    SECTION("async")
+    {
+        const int types[] = {IO_ENGINE_URING, IO_ENGINE_THREADS};
+        for (int t = 0; t < 2; ++t) {
+            File file;
+            file.open("table.db");
+            int ret = file.setAsync(8, types[t]);
+            REQUIRE(ret == S_OK);
+            REQUIRE(file.async());
+            if (types[t] == IO_ENGINE_THREADS)
+                REQUIRE(file.engine_->type() == IO_ENGINE_THREADS);
+
+            // 一次提交超过队列深度的写请求
+            const int count = 100;
+            static char wbuf[count][512];
+            static char rbuf[count][512];
+            IoRequest reqs[count];
+            for (int i = 0; i < count; ++i) {
+                memset(wbuf[i], 'a' + i % 26, sizeof(wbuf[i]));
+                reqs[i].opcode = IO_WRITE;
+                reqs[i].offset = i * sizeof(wbuf[i]);
+                reqs[i].buffer = wbuf[i];
+                reqs[i].length = sizeof(wbuf[i]);
+            }
+            ret = file.batch(reqs, count);
+            REQUIRE(ret == S_OK);
+
+            // 提交读请求，分批收割
+            for (int i = 0; i < count; ++i) {
+                reqs[i].opcode = IO_READ;
+                reqs[i].buffer = rbuf[i];
+                reqs[i].data = (void *) (size_t) i;
+            }
+            ret = file.submit(reqs, count);
+            REQUIRE(ret == S_OK);
+            int left = count;
+            while (left > 0) {
+                IoRequest *done[16];
+                int n = 0;
+                ret = file.complete(done, 16, 1, n);
+                REQUIRE(ret == S_OK);
+                REQUIRE(n > 0);
+                for (int j = 0; j < n; ++j) {
+                    int i = (int) (size_t) done[j]->data;
+                    REQUIRE(done[j]->result == S_OK);
+                    REQUIRE(done[j]->bytes == sizeof(rbuf[i]));
+                    REQUIRE(memcmp(rbuf[i], wbuf[i], sizeof(rbuf[i])) == 0);
+                }
+                left -= n;
+            }
+
+            // 文件尾之后的读返回0字节
+            IoRequest eof;
+            eof.offset = count * sizeof(rbuf[0]);
+            eof.buffer = rbuf[0];
+            eof.length = sizeof(rbuf[0]);
+            ret = file.batch(&eof, 1);
+            REQUIRE(ret == S_OK);
+            REQUIRE(eof.bytes == 0);
+
+            file.close();
+            REQUIRE(!file.async());
+        }
+    }
+
+    SECTION("memory")
+    {
+        File file;
+        int ret = file.open("memory.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        REQUIRE(file.handle_ == INVALID_HANDLE_VALUE);
+
+        // 写超出段尾时变长，中间读到0
+        const char *hello = "hello, world";
+        ret = file.write(100, hello, strlen(hello));
+        REQUIRE(ret == S_OK);
+        unsigned long long len;
+        file.length(len);
+        REQUIRE(len == 100 + strlen(hello));
+        char buf[128];
+        size_t bytes;
+        ret = file.read(0, buf, sizeof(buf), &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == len);
+        REQUIRE(buf[0] == 0);
+        REQUIRE(strncmp(buf + 100, hello, strlen(hello)) == 0);
+
+        // 分散读
+        char a[100], b[12];
+        struct iovec iov[2];
+        iov[0].iov_base = a;
+        iov[0].iov_len = sizeof(a);
+        iov[1].iov_base = b;
+        iov[1].iov_len = sizeof(b);
+        ret = file.readv(0, iov, 2, &bytes);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bytes == sizeof(a) + sizeof(b));
+        REQUIRE(strncmp(b, hello, sizeof(b)) == 0);
+
+        // 映射视图直接指向段
+        ret = file.map();
+        REQUIRE(ret == S_OK);
+        REQUIRE(memcmp(file.view(100, strlen(hello)), hello, strlen(hello)) == 0);
+        // 映射期间只读，同一段的其它打开者不能使段重新分配
+        unsigned char *view = file.view(0, 1);
+        REQUIRE(file.write(0, hello, 1, &bytes) == EROFS);
+        REQUIRE(bytes == 0);
+        REQUIRE(file.allocate(0, 1024 * 1024) == EROFS);
+        REQUIRE(file.punch(0, 16) == EROFS);
+        File other;
+        REQUIRE(other.open("memory.db", OPEN_MEMORY) == S_OK);
+        REQUIRE(other.allocate(0, 1024 * 1024) == EBUSY);
+        REQUIRE(other.write(0, "H", 1) == S_OK);
+        REQUIRE(view[0] == 'H');
+        file.unmap();
+        REQUIRE(other.write(0, "\0", 1) == S_OK);
+        other.close();
+        REQUIRE(file.write(0, "\0", 1) == S_OK);
+
+        // 异步模式退回线程池
+        ret = file.setAsync();
+        REQUIRE(ret == S_OK);
+        REQUIRE(file.engine_->type() == IO_ENGINE_THREADS);
+        IoRequest req;
+        req.offset = 100;
+        req.buffer = buf;
+        req.length = strlen(hello);
+        ret = file.batch(&req, 1);
+        REQUIRE(ret == S_OK);
+        REQUIRE(strncmp(buf, hello, strlen(hello)) == 0);
+        file.close();
+
+        // 关闭后内容保留，删除后重新打开为空
+        ret = file.open("memory.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        file.length(len);
+        REQUIRE(len == 100 + strlen(hello));
+        file.close();
+        REQUIRE(File::remove("memory.db") == S_OK);
+        ret = file.open("memory.db", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        file.length(len);
+        REQUIRE(len == 0);
+        file.close();
+        REQUIRE(File::remove("memory.db") == S_OK);
+    }
+
+    SECTION("mode")
+    {
+        // 不存在时不创建
+        File file;
+        File::remove("mode.db");
+        REQUIRE(file.open("mode.db", OPEN_NOCREATE) == ENOENT);
+        REQUIRE(file.open("mode.db") == S_OK);
+        REQUIRE(file.write(0, hello, strlen(hello)) == S_OK);
+        file.close();
+        REQUIRE(file.open("mode.db", OPEN_NOCREATE) == S_OK);
+        file.close();
+
+        // 截断后长度为0
+        unsigned long long len = 0;
+        REQUIRE(file.open("mode.db", OPEN_TRUNCATE) == S_OK);
+        file.length(len);
+        REQUIRE(len == 0);
+        file.close();
+        REQUIRE(File::remove("mode.db") == S_OK);
+    }
+
     SECTION("remove")
     {
         int ret = File::remove("table.db");
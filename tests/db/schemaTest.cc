@@ -48,6 +48,22 @@ TEST_CASE("db/schema.h")
         REQUIRE(ret == S_OK);
     }
 
+    SECTION("map")
+    {
+        Schema schema("daxx.db");
+        int ret = schema.open(true);
+        REQUIRE(ret == S_OK);
+        std::pair<Schema::TableSpace::iterator, bool> bret =
+            schema.lookup("table");
+        REQUIRE(bret.second);
+        REQUIRE(bret.first->second.fields.size() == 3);
+
+        // 映射模式只读
+        RelationInfo relation;
+        ret = schema.create("table2", relation);
+        REQUIRE(ret == EROFS);
+    }
+
     SECTION("load")
     {
         Schema schema("daxx.db");
@@ -66,4 +82,40 @@ TEST_CASE("db/schema.h")
         REQUIRE(it->second.file.remove("table.dat") == S_OK);
         REQUIRE(schema.destroy() == S_OK);
     }
-}
\ No newline at end of file
+
+    SECTION("memory")
+    {
+        {
+            Schema schema("memory.db");
+            int ret = schema.open(false, OPEN_MEMORY);
+            REQUIRE(ret == S_OK);
+            RelationInfo relation;
+            relation.path = "memory.dat";
+            FieldInfo field;
+            field.name = "id";
+            field.index = 0;
+            field.length = 8;
+            field.fieldType = "BIGINT";
+            relation.fields.push_back(field);
+            relation.count = 1;
+            relation.key = 0;
+            ret = schema.create("memory", relation);
+            REQUIRE(ret == S_OK);
+        }
+
+        // 元文件在内存中，重新打开可以看到之前建的表，表也在内存中
+        Schema schema("memory.db");
+        int ret = schema.open(false, OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        std::pair<Schema::TableSpace::iterator, bool> bret =
+            schema.lookup("memory");
+        REQUIRE(bret.second);
+        ret = schema.load(bret.first);
+        REQUIRE(ret == S_OK);
+        REQUIRE(bret.first->second.file.segment_ != NULL);
+
+        bret.first->second.file.close();
+        REQUIRE(File::remove("memory.dat") == S_OK);
+        REQUIRE(schema.destroy() == S_OK);
+    }
+}
@@ -8,6 +8,8 @@
 //
 #include "../catch.hpp"
 #include <db/table.h>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 using namespace db;
 
@@ -64,6 +66,11 @@ TEST_CASE("db/table.h")
         REQUIRE(ret == S_OK);
         ret = table.initial();
         REQUIRE(ret == S_OK);
+        // 插入时后台写回、做检查点
+        TimeStamp before;
+        before.now();
+        ret = gbuffer.startWriter(5, 50);
+        REQUIRE(ret == S_OK);
         std::cout << "freelength:" << table.freelength() << std::endl;
         std::cout << "slotsNum:" << table.slotsNum() << std::endl;
         for (int i = 10000; i > 0; i--) {
@@ -71,10 +78,10 @@ TEST_CASE("db/table.h")
             long long id = i;
             iov[0].iov_base = &id;
             iov[0].iov_len = sizeof(long long);
-            char *phone = "13534500702";
+            const char *phone = "13534500702";
             iov[1].iov_base = (void *) phone;
             iov[1].iov_len = strlen(phone) + 1;
-            char *name =
+            const char *name =
                 "JunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixx"
                 "xxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJuni"
                 "xxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJunixxxxJuni"
@@ -103,11 +110,192 @@ TEST_CASE("db/table.h")
 
                 record.specialRef(Field, 1);
                 char *FieldPointer = (char *) Field.iov_base;
-                char *phone = "13534500702";
+                const char *phone = "13534500702";
                 REQUIRE(
                     strncmp(FieldPointer, phone, strlen(FieldPointer)) == 0);
             }
         }
+        // 每个block头部的fence与首尾记录一致，block之间有序
+        long long high = 0;
+        for (auto bit = table.blockBegin(); bit != table.blockEnd(); ++bit) {
+            DataBlock block = *bit;
+            unsigned short slots = block.getSlotsNum();
+            if (slots == 0) continue;
+            iovec low, top, first, last;
+            REQUIRE(block.getLow(0, low));
+            REQUIRE(block.getHigh(0, top));
+            REQUIRE(block.getKey(0, 0, first));
+            REQUIRE(block.getKey(slots - 1, 0, last));
+            REQUIRE(*(long long *) low.iov_base == *(long long *) first.iov_base);
+            REQUIRE(*(long long *) top.iov_base == *(long long *) last.iov_base);
+            REQUIRE(*(long long *) low.iov_base > high);
+            high = *(long long *) top.iov_base;
+        }
+        REQUIRE(high == 10000);
+
+        // 按key点查，block内二分查找
+        for (long long i = 1; i <= 10000; i += 999) {
+            iovec field;
+            field.iov_base = &i;
+            field.iov_len = sizeof(long long);
+            long long id = 0;
+            char phone[32], name[512];
+            struct iovec iov[3];
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(id);
+            iov[1].iov_base = phone;
+            iov[1].iov_len = sizeof(phone);
+            iov[2].iov_base = name;
+            iov[2].iov_len = sizeof(name);
+            unsigned char header = 0;
+            ret = table.get(field, &header, iov, 3);
+            REQUIRE(ret == S_OK);
+            REQUIRE(id == i);
+            REQUIRE(strcmp(phone, "13534500702") == 0);
+            REQUIRE(strncmp(name, "Junixxxx", 8) == 0);
+            REQUIRE(strlen(name) + 1 == iov[2].iov_len);
+            // buffer不够
+            iov[2].iov_len = 8;
+            REQUIRE(table.get(field, &header, iov, 3) == EINVAL);
+        }
+        // 不存在的key，在范围内外都找不到
+        for (long long i = 0; i <= 20000; i += 20000) {
+            iovec field;
+            field.iov_base = &i;
+            field.iov_len = sizeof(long long);
+            long long id = 0;
+            struct iovec iov[1];
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(id);
+            unsigned char header = 0;
+            REQUIRE(table.get(field, &header, iov, 1) == S_FALSE);
+            REQUIRE(table.remove(field) == S_FALSE);
+        }
+
+        gbuffer.stopWriter();
+        REQUIRE(gbuffer.stats().writes > 0);
+        REQUIRE(gbuffer.stats().checkpoints > 0);
+
+        // 关闭时做检查点，脏页全部写回，root记下检查点时戳
+        table.close("tablee.dat");
+        REQUIRE(gbuffer.dirty() == 0);
+        File file;
+        file.open("tablee.dat");
+        unsigned char rb[Root::ROOT_SIZE];
+        file.read(0, (char *) rb, Root::ROOT_SIZE);
+        Root root;
+        root.attach(rb);
+        REQUIRE(root.getTimeStamp() >= before);
+        file.close();
+    }
+    SECTION("extent")
+    {
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+
+        // 按extent预分配，文件长度与root记录一致
+        File &file = gschema.lookup("tablee").first->second.file;
+        unsigned char rb[Root::ROOT_SIZE];
+        file.read(0, (char *) rb, Root::ROOT_SIZE);
+        Root root;
+        root.attach(rb);
+        unsigned int allocated = root.getAllocated();
+        REQUIRE(allocated >= root.getCnt());
+        REQUIRE(allocated % Table::DEFAULT_EXTENT_BLOCKS == 0);
+        unsigned long long length;
+        file.length(length);
+        REQUIRE(
+            length == (unsigned long long) allocated * Block::BLOCK_SIZE +
+                          Root::ROOT_SIZE);
+        table.close("tablee.dat");
+    }
+    SECTION("readahead")
+    {
+        // 不预热，扫描从文件读
+        File::remove("tablee.dat.warm");
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        ret = table.setReadahead(8);
+        REQUIRE(ret == S_OK);
+
+        // 预读下扫描结果不变
+        long long cnt = 1;
+        int blocks = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            ++blocks;
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                long long *keyFieldPointer = (long long *) keyField.iov_base;
+                REQUIRE(*keyFieldPointer == cnt++);
+            }
+        }
+        REQUIRE(cnt == 10001);
+        // 第1个block在initial时已读入，之后只有第一次未命中，其余都由窗口供给
+        REQUIRE(blocks > 100);
+        REQUIRE(table.readaheadMisses() <= 1);
+        REQUIRE(table.readaheadHits() + 2 >= (unsigned long long) blocks);
+        table.close("tablee.dat");
+    }
+    SECTION("warm")
+    {
+        // 上次关闭时保存了缓冲的block列表，打开时一次读入
+        File &file = gschema.lookup("tablee").first->second.file;
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        REQUIRE(gbuffer.cached(&file, 1));
+        // 相邻的block合并读入，文件仍是同步模式
+        REQUIRE(!file.async());
+        BufferStats before = gbuffer.stats();
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        long long cnt = 0;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1)
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2)
+                ++cnt;
+        REQUIRE(cnt == 10000);
+        REQUIRE(gbuffer.stats().misses == before.misses);
+        table.close("tablee.dat");
+    }
+    SECTION("map")
+    {
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        ret = table.map(MAP_ADVICE_SEQUENTIAL);
+        REQUIRE(ret == S_OK);
+
+        // 映射模式下扫描
+        long long cnt = 1;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                long long *keyFieldPointer = (long long *) keyField.iov_base;
+                REQUIRE(*keyFieldPointer == cnt++);
+            }
+        }
+        REQUIRE(cnt == 10001);
+
+        // 映射模式只读
+        iovec field;
+        long long id = 1;
+        field.iov_base = &id;
+        field.iov_len = sizeof(long long);
+        REQUIRE(table.remove(field) == EROFS);
+
+        table.unmap();
         table.close("tablee.dat");
     }
     SECTION("remove")
@@ -141,12 +329,182 @@ TEST_CASE("db/table.h")
 
             record.specialRef(Field, 1);
             char *FieldPointer = (char *) Field.iov_base;
-            char *phone = "13534500702";
+            const char *phone = "13534500702";
             REQUIRE(strncmp(FieldPointer, phone, strlen(FieldPointer)) == 0);
             std::cout << "remove:" << i << std::endl;
         }
         table.close("tablee.dat");
     }
+    SECTION("garbage")
+    {
+        Table table;
+        int ret = table.open("tablee");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        table.setPunch(true);
+
+        // 数据链和空闲链的长度
+        File &file = gschema.lookup("tablee").first->second.file;
+        auto chains = [&](unsigned int &cnt, int &live, int &free) {
+            // 直接读文件，先写回缓冲池中的脏页
+            REQUIRE(gbuffer.flush(&file) == S_OK);
+            unsigned char rb[Root::ROOT_SIZE];
+            file.read(0, (char *) rb, Root::ROOT_SIZE);
+            Root root;
+            root.attach(rb);
+            cnt = root.getCnt();
+            live = 0;
+            for (auto bit = table.blockBegin(); bit != table.blockEnd(); ++bit)
+                ++live;
+            free = 0;
+            unsigned char *bb = new unsigned char[Block::BLOCK_SIZE];
+            unsigned int id = (unsigned int) root.getGarbage();
+            while (id != 0) {
+                file.read(
+                    (id - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE,
+                    (char *) bb,
+                    Block::BLOCK_SIZE);
+                Block block;
+                block.attach(bb);
+                REQUIRE((unsigned int) block.blockid() == id);
+                id = (unsigned int) block.getNextid();
+                ++free;
+            }
+            delete[] bb;
+        };
+
+        // remove之后只剩最后一个block，其余都在空闲链上
+        unsigned int cnt;
+        int live, free;
+        chains(cnt, live, free);
+        REQUIRE(live == 1);
+        REQUIRE(free == (int) cnt - 1);
+
+        // 新block优先取空闲链，文件不增长
+        for (long long i = 20001; i <= 20500; i++) {
+            struct iovec iov[3];
+            long long id = i;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            const char *phone = "13534500702";
+            iov[1].iov_base = (void *) phone;
+            iov[1].iov_len = strlen(phone) + 1;
+            std::string name(200, 'x');
+            iov[2].iov_base = (void *) name.c_str();
+            iov[2].iov_len = name.size() + 1;
+            unsigned char header = 0x84;
+            ret = table.insert(&header, iov, 3);
+            REQUIRE(ret == S_OK);
+        }
+        unsigned int cnt2;
+        int live2, free2;
+        chains(cnt2, live2, free2);
+        REQUIRE(cnt2 == cnt);
+        REQUIRE(live2 > 1);
+        REQUIRE(live2 + free2 == (int) cnt);
+
+        // 再删除，block回到空闲链并打洞
+        for (long long i = 20001; i <= 20500; i++) {
+            iovec field;
+            long long id = i;
+            field.iov_base = &id;
+            field.iov_len = sizeof(long long);
+            ret = table.remove(field);
+            REQUIRE(ret == S_OK);
+        }
+        chains(cnt2, live2, free2);
+        REQUIRE(cnt2 == cnt);
+        REQUIRE(live2 == 1);
+        REQUIRE(free2 == (int) cnt - 1);
+
+        // 反复插入、删除，记录空间在block内重用，不再分裂
+        for (int round = 0; round < 20; ++round) {
+            for (long long i = 30001; i <= 30030; i++) {
+                struct iovec iov[3];
+                long long id = i;
+                iov[0].iov_base = &id;
+                iov[0].iov_len = sizeof(long long);
+                const char *phone = "13534500702";
+                iov[1].iov_base = (void *) phone;
+                iov[1].iov_len = strlen(phone) + 1;
+                std::string name(200 + round, 'y');
+                iov[2].iov_base = (void *) name.c_str();
+                iov[2].iov_len = name.size() + 1;
+                unsigned char header = 0x84;
+                ret = table.insert(&header, iov, 3);
+                REQUIRE(ret == S_OK);
+            }
+            chains(cnt2, live2, free2);
+            REQUIRE(live2 == 1);
+            for (long long i = 30001; i <= 30030; i++) {
+                iovec field;
+                long long id = i;
+                field.iov_base = &id;
+                field.iov_len = sizeof(long long);
+                ret = table.remove(field);
+                REQUIRE(ret == S_OK);
+            }
+        }
+        REQUIRE(cnt2 == cnt);
+
+        // 一个block只放得下两条的大记录，乱序插入时反复分裂，都能找到
+        long long bigs[] = {40004, 40001, 40006, 40002, 40005, 40003};
+        std::string big(7000, 'z');
+        for (long long i : bigs) {
+            struct iovec iov[3];
+            long long id = i;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            const char *phone = "13534500702";
+            iov[1].iov_base = (void *) phone;
+            iov[1].iov_len = strlen(phone) + 1;
+            iov[2].iov_base = (void *) big.c_str();
+            iov[2].iov_len = big.size() + 1;
+            unsigned char header = 0x84;
+            ret = table.insert(&header, iov, 3);
+            REQUIRE(ret == S_OK);
+        }
+        for (long long i = 40001; i <= 40006; i++) {
+            iovec field;
+            field.iov_base = &i;
+            field.iov_len = sizeof(long long);
+            long long id = 0;
+            char phone[32];
+            std::string name(big.size() + 1, '\0');
+            struct iovec iov[3];
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(id);
+            iov[1].iov_base = phone;
+            iov[1].iov_len = sizeof(phone);
+            iov[2].iov_base = &name[0];
+            iov[2].iov_len = name.size();
+            unsigned char header = 0;
+            REQUIRE(table.get(field, &header, iov, 3) == S_OK);
+            REQUIRE(id == i);
+            REQUIRE(name.compare(0, big.size(), big) == 0);
+            REQUIRE(table.remove(field) == S_OK);
+        }
+
+        // 空block也放不下的记录返回EINVAL，不会一直分裂
+        {
+            struct iovec iov[3];
+            long long id = 50001;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            const char *phone = "13534500702";
+            iov[1].iov_base = (void *) phone;
+            iov[1].iov_len = strlen(phone) + 1;
+            std::string huge(Block::BLOCK_SIZE, 'h');
+            iov[2].iov_base = (void *) huge.c_str();
+            iov[2].iov_len = huge.size() + 1;
+            unsigned char header = 0x84;
+            REQUIRE(table.insert(&header, iov, 3) == EINVAL);
+        }
+        chains(cnt2, live2, free2);
+        REQUIRE(live2 == 1);
+        table.close("tablee.dat");
+    }
     SECTION("updata")
     {
         iovec field;
@@ -158,10 +516,10 @@ TEST_CASE("db/table.h")
         long long id = 3;
         iov[0].iov_base = &id;
         iov[0].iov_len = sizeof(long long);
-        char *phone = "13318181238";
+        const char *phone = "13318181238";
         iov[1].iov_base = (void *) phone;
         iov[1].iov_len = strlen(phone) + 1;
-        char *name = "Junix";
+        const char *name = "Junix";
         iov[2].iov_base = (void *) name;
         iov[2].iov_len = strlen(name) + 1;
         unsigned char header = 0x84;
@@ -195,6 +553,436 @@ TEST_CASE("db/table.h")
         REQUIRE(strncmp(FieldPointer, phone, strlen(FieldPointer)) == 0);
         table.close("tablee.dat");
     }
+    SECTION("memory")
+    {
+        RelationInfo relation;
+        relation.path = "tablem.dat";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        int ret = table.create("tablem", relation);
+        REQUIRE(ret == S_OK);
+        ret = table.open("tablem", OPEN_MEMORY);
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+
+        // 表文件在内存段上，插入和扫描与磁盘表一致
+        for (long long i = 1000; i > 0; i--) {
+            struct iovec iov[2];
+            long long id = i;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            std::string name(100, 'm');
+            iov[1].iov_base = (void *) name.c_str();
+            iov[1].iov_len = name.size() + 1;
+            unsigned char header = 0x84;
+            ret = table.insert(&header, iov, 2);
+            REQUIRE(ret == S_OK);
+        }
+        long long cnt = 1;
+        for (auto it1 = table.blockBegin(); it1 != table.blockEnd(); ++it1) {
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2) {
+                Record record = *it2;
+                iovec keyField;
+                record.specialRef(keyField, 0);
+                REQUIRE(*(long long *) keyField.iov_base == cnt++);
+            }
+        }
+        REQUIRE(cnt == 1001);
+        table.close("tablem.dat");
+        REQUIRE(table.destroy("tablem.dat") == S_OK);
+    }
+    SECTION("blocksize")
+    {
+        const unsigned int sizes[] = {4096, 65536};
+        const char *names[] = {"table4k", "table64k"};
+        for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); ++n) {
+            // create会改写relation，每张表重新填充
+            std::string path = std::string(names[n]) + ".dat";
+            RelationInfo relation;
+            relation.path = path;
+            FieldInfo field;
+            field.name = "id";
+            field.index = 0;
+            field.length = 8;
+            field.fieldType = "BIGINT";
+            relation.fields.push_back(field);
+            field.name = "name";
+            field.index = 1;
+            field.length = -255;
+            field.fieldType = "VARCHAR";
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+
+            Table table;
+            int ret = table.create(names[n], relation);
+            REQUIRE(ret == S_OK);
+            ret = table.open(names[n]);
+            REQUIRE(ret == S_OK);
+            REQUIRE(table.blockSize() == Block::BLOCK_SIZE);
+            REQUIRE(table.setBlockSize(3000) == EINVAL);
+            REQUIRE(table.setBlockSize(1024 * 128) == EINVAL);
+            REQUIRE(table.setBlockSize(sizes[n]) == S_OK);
+            REQUIRE(table.blockSize() == sizes[n]);
+            ret = table.initial();
+            REQUIRE(ret == S_OK);
+
+            for (long long i = 3000; i > 0; i--) {
+                struct iovec iov[2];
+                long long id = i;
+                iov[0].iov_base = &id;
+                iov[0].iov_len = sizeof(long long);
+                std::string name(100, 'b');
+                iov[1].iov_base = (void *) name.c_str();
+                iov[1].iov_len = name.size() + 1;
+                unsigned char header = 0x84;
+                ret = table.insert(&header, iov, 2);
+                REQUIRE(ret == S_OK);
+            }
+            // 已有数据，不能再改
+            REQUIRE(table.setBlockSize(Block::BLOCK_SIZE) == EBUSY);
+            for (long long i = 1; i <= 3000; i += 2) {
+                iovec key;
+                key.iov_base = &i;
+                key.iov_len = sizeof(long long);
+                REQUIRE(table.remove(key) == S_OK);
+            }
+            table.close(path.c_str());
+
+            // 重新打开，block大小从root读出，block从磁盘按该大小读入
+            ret = table.open(names[n]);
+            REQUIRE(ret == S_OK);
+            REQUIRE(table.blockSize() == sizes[n]);
+            ret = table.initial();
+            REQUIRE(ret == S_OK);
+            ret = table.setReadahead(4);
+            REQUIRE(ret == S_OK);
+            long long cnt = 2;
+            for (auto it1 = table.blockBegin(PIN_ONCE); it1 != table.blockEnd();
+                 ++it1) {
+                for (auto it2 = table.begin(it1); it2 != table.end(it1);
+                     ++it2) {
+                    Record record = *it2;
+                    iovec keyField;
+                    record.specialRef(keyField, 0);
+                    REQUIRE(*(long long *) keyField.iov_base == cnt);
+                    cnt += 2;
+                }
+            }
+            REQUIRE(cnt == 3002);
+            for (long long i = 1; i <= 3000; ++i) {
+                iovec key;
+                key.iov_base = &i;
+                key.iov_len = sizeof(long long);
+                long long id = 0;
+                char name[256];
+                struct iovec iov[2];
+                iov[0].iov_base = &id;
+                iov[0].iov_len = sizeof(id);
+                iov[1].iov_base = name;
+                iov[1].iov_len = sizeof(name);
+                unsigned char header = 0;
+                ret = table.get(key, &header, iov, 2);
+                REQUIRE(ret == (i % 2 ? S_FALSE : S_OK));
+                if (ret == S_OK) REQUIRE(id == i);
+            }
+            // 文件按block大小预分配
+            unsigned long long length;
+            File &file = gschema.lookup(names[n]).first->second.file;
+            REQUIRE(file.length(length) == S_OK);
+            REQUIRE((length - Root::ROOT_SIZE) % sizes[n] == 0);
+
+            // 打洞回收，4KB的block只保留头部一页，跳过打洞，不报错
+            table.setPunch(true);
+            for (long long i = 2; i <= 3000; i += 2) {
+                iovec key;
+                key.iov_base = &i;
+                key.iov_len = sizeof(long long);
+                REQUIRE(table.remove(key) == S_OK);
+            }
+            REQUIRE(gbuffer.flush(&file) == S_OK);
+            unsigned char rb[Root::ROOT_SIZE];
+            REQUIRE(file.read(0, (char *) rb, Root::ROOT_SIZE) == S_OK);
+            Root root;
+            root.attach(rb);
+            unsigned int garbage = (unsigned int) root.getGarbage();
+            REQUIRE(garbage != 0);
+            std::string page(File::IO_ALIGNMENT, 'x');
+            size_t offset = (size_t) (garbage - 1) * sizes[n] +
+                            Root::ROOT_SIZE + File::IO_ALIGNMENT;
+            REQUIRE(file.read(offset, &page[0], page.size()) == S_OK);
+            // 64KB的block头部之后读到0，4KB的已是下一个block
+            if (sizes[n] > File::IO_ALIGNMENT)
+                REQUIRE(page == std::string(page.size(), '\0'));
+            unsigned long long length2;
+            REQUIRE(file.length(length2) == S_OK);
+            REQUIRE(length2 == length);
+
+            // 空闲链上的block可以重用
+            for (long long i = 1; i <= 300; ++i) {
+                struct iovec iov[2];
+                long long id = i;
+                iov[0].iov_base = &id;
+                iov[0].iov_len = sizeof(long long);
+                std::string name(100, 'c');
+                iov[1].iov_base = (void *) name.c_str();
+                iov[1].iov_len = name.size() + 1;
+                unsigned char header = 0x84;
+                REQUIRE(table.insert(&header, iov, 2) == S_OK);
+            }
+            for (long long i = 1; i <= 300; ++i) {
+                iovec key;
+                key.iov_base = &i;
+                key.iov_len = sizeof(long long);
+                long long id = 0;
+                char name[256];
+                struct iovec iov[2];
+                iov[0].iov_base = &id;
+                iov[0].iov_len = sizeof(id);
+                iov[1].iov_base = name;
+                iov[1].iov_len = sizeof(name);
+                unsigned char header = 0;
+                REQUIRE(table.get(key, &header, iov, 2) == S_OK);
+                REQUIRE(id == i);
+            }
+            table.close(path.c_str());
+            REQUIRE(table.destroy(path.c_str()) == S_OK);
+        }
+    }
+    SECTION("format")
+    {
+        RelationInfo relation;
+        relation.path = "tableold.dat";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        relation.count = 1;
+        relation.key = 0;
+
+        Table table;
+        int ret = table.create("tableold", relation);
+        REQUIRE(ret == S_OK);
+        ret = table.open("tableold");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        table.close("tableold.dat");
+
+        // 新表记下当前格式
+        File file;
+        REQUIRE(file.open("tableold.dat") == S_OK);
+        unsigned char rb[Root::ROOT_SIZE];
+        REQUIRE(file.read(0, (char *) rb, Root::ROOT_SIZE) == S_OK);
+        Root root;
+        root.attach(rb);
+        REQUIRE(root.getFormat() == Root::FORMAT_VERSION);
+
+        // 改成fence之前的旧格式，打开时拒绝，不按新布局解析
+        root.setFormat(0);
+        root.setChecksum();
+        REQUIRE(file.write(0, (const char *) rb, Root::ROOT_SIZE) == S_OK);
+        file.close();
+        REQUIRE(table.open("tableold") == ENOTSUP);
+        table.close("tableold.dat");
+        REQUIRE(table.destroy("tableold.dat") == S_OK);
+    }
+    SECTION("checksum")
+    {
+        const int algorithms[] = {CHECKSUM_INET, CHECKSUM_CRC32C};
+        const char *names[] = {"tableinet", "tablecrc"};
+        for (int n = 0; n < 2; ++n) {
+            std::string path = std::string(names[n]) + ".dat";
+            RelationInfo relation;
+            relation.path = path;
+            FieldInfo field;
+            field.name = "id";
+            field.index = 0;
+            field.length = 8;
+            field.fieldType = "BIGINT";
+            relation.fields.push_back(field);
+            field.name = "name";
+            field.index = 1;
+            field.length = -255;
+            field.fieldType = "VARCHAR";
+            relation.fields.push_back(field);
+            relation.count = 2;
+            relation.key = 0;
+
+            Table table;
+            int ret = table.create(names[n], relation);
+            REQUIRE(ret == S_OK);
+            ret = table.open(names[n]);
+            REQUIRE(ret == S_OK);
+            // 新表缺省用CRC32C
+            REQUIRE(table.checksumAlgorithm() == CHECKSUM_CRC32C);
+            REQUIRE(table.setChecksumAlgorithm(2) == EINVAL);
+            REQUIRE(table.setChecksumAlgorithm(algorithms[n]) == S_OK);
+            ret = table.initial();
+            REQUIRE(ret == S_OK);
+            for (long long i = 1000; i > 0; i--) {
+                struct iovec iov[2];
+                long long id = i;
+                iov[0].iov_base = &id;
+                iov[0].iov_len = sizeof(long long);
+                std::string name(100, 'c');
+                iov[1].iov_base = (void *) name.c_str();
+                iov[1].iov_len = name.size() + 1;
+                unsigned char header = 0x84;
+                ret = table.insert(&header, iov, 2);
+                REQUIRE(ret == S_OK);
+            }
+            REQUIRE(table.setChecksumAlgorithm(CHECKSUM_INET) == EBUSY);
+            table.close(path.c_str());
+
+            // 重新打开，算法从root读出，磁盘上的block都能通过检验
+            unsigned long long verifies = gbuffer.stats().verifies;
+            ret = table.open(names[n]);
+            REQUIRE(ret == S_OK);
+            REQUIRE(table.checksumAlgorithm() == algorithms[n]);
+            ret = table.initial();
+            REQUIRE(ret == S_OK);
+            int blocks = 0;
+            for (auto bit = table.blockBegin(); bit != table.blockEnd();
+                 ++bit) {
+                DataBlock block = *bit;
+                REQUIRE(block.algorithm() == algorithms[n]);
+                REQUIRE(block.checksum());
+                ++blocks;
+            }
+            REQUIRE(blocks > 1);
+            // 缓冲池读入时同样检验过
+            REQUIRE(gbuffer.stats().verifies >= verifies + blocks);
+            REQUIRE(gbuffer.stats().corruptions == 0);
+            table.close(path.c_str());
+            REQUIRE(table.destroy(path.c_str()) == S_OK);
+        }
+    }
+    SECTION("corrupt")
+    {
+        RelationInfo relation;
+        relation.path = "tablebad.dat";
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        int ret = table.create("tablebad", relation);
+        REQUIRE(ret == S_OK);
+        ret = table.open("tablebad");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        for (long long i = 1000; i > 0; i--) {
+            struct iovec iov[2];
+            long long id = i;
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            std::string name(100, 'd');
+            iov[1].iov_base = (void *) name.c_str();
+            iov[1].iov_len = name.size() + 1;
+            unsigned char header = 0x84;
+            ret = table.insert(&header, iov, 2);
+            REQUIRE(ret == S_OK);
+        }
+        table.close("tablebad.dat");
+
+        // 改坏链上第2个block的一条记录，不预热，block从磁盘读入
+        File file;
+        REQUIRE(file.open("tablebad.dat") == S_OK);
+        unsigned char rb[Root::ROOT_SIZE];
+        REQUIRE(file.read(0, (char *) rb, Root::ROOT_SIZE) == S_OK);
+        Root root;
+        root.attach(rb);
+        unsigned char *bb = new unsigned char[Block::BLOCK_SIZE];
+        size_t offset =
+            (size_t) (root.getHead() - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        REQUIRE(file.read(offset, (char *) bb, Block::BLOCK_SIZE) == S_OK);
+        DataBlock block;
+        block.attach(bb);
+        unsigned int second = (unsigned int) block.getNextid();
+        REQUIRE(second != (unsigned int) -1);
+        offset = (size_t) (second - 1) * Block::BLOCK_SIZE + Root::ROOT_SIZE;
+        REQUIRE(file.read(offset, (char *) bb, Block::BLOCK_SIZE) == S_OK);
+        bb[DataBlock::BLOCK_DATA_START + 16] ^= 0xff;
+        REQUIRE(file.write(offset, (const char *) bb, Block::BLOCK_SIZE) == S_OK);
+        file.close();
+        delete[] bb;
+        File::remove("tablebad.dat.warm");
+
+        // 经缓冲池读和经预读读，扫描都停在坏block上，迭代器返回EIO
+        REQUIRE(gbuffer.setVerify(VERIFY_ALWAYS) == S_OK);
+        ret = table.open("tablebad");
+        REQUIRE(ret == S_OK);
+        ret = table.initial();
+        REQUIRE(ret == S_OK);
+        const unsigned int windows[] = {0, 4};
+        for (size_t n = 0; n < sizeof(windows) / sizeof(windows[0]); ++n) {
+            REQUIRE(table.setReadahead(windows[n]) == S_OK);
+            unsigned long long corruptions = gbuffer.stats().corruptions;
+            long long cnt = 0;
+            int blocks = 0;
+            auto it1 = table.blockBegin(PIN_ONCE);
+            for (; it1 != table.blockEnd(); ++it1) {
+                for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2)
+                    ++cnt;
+                ++blocks;
+            }
+            REQUIRE(it1.getError() == EIO);
+            REQUIRE(blocks == 2);
+            REQUIRE(cnt > 0);
+            REQUIRE(cnt < 1000);
+            REQUIRE(gbuffer.stats().corruptions > corruptions);
+        }
+
+        // 点查、删除、插入经过坏block时返回EIO
+        long long id = 1000;
+        iovec key;
+        key.iov_base = &id;
+        key.iov_len = sizeof(long long);
+        std::string name(256, '\0');
+        struct iovec iov[2];
+        iov[0].iov_base = &id;
+        iov[0].iov_len = sizeof(id);
+        iov[1].iov_base = &name[0];
+        iov[1].iov_len = name.size();
+        unsigned char header = 0;
+        REQUIRE(table.get(key, &header, iov, 2) == EIO);
+        REQUIRE(table.remove(key) == EIO);
+        id = 2000;
+        iov[1].iov_len = 10;
+        header = 0x84;
+        REQUIRE(table.insert(&header, iov, 2) == EIO);
+        table.close("tablebad.dat");
+        REQUIRE(gbuffer.setVerify(VERIFY_FIRST) == S_OK);
+        REQUIRE(table.destroy("tablebad.dat") == S_OK);
+    }
     SECTION("destroy")
     {
         Table table;
@@ -204,4 +992,92 @@ TEST_CASE("db/table.h")
         REQUIRE(table.destroy("tablee.dat") == S_OK);
         REQUIRE(gschema.destroy() == S_OK);
     }
-}
\ No newline at end of file
+}
+// 不同block大小的插入、扫描、点查性能，缺省不运行，utest "[.bench]"
+TEST_CASE("db/table.h/blocksize", "[.bench]")
+{
+    int ret = dbInitialize();
+    REQUIRE(ret == S_OK);
+    const long long rows = 20000;
+    for (unsigned int size = Block::MIN_BLOCK_SIZE;
+         size <= (unsigned int) Block::MAX_BLOCK_SIZE;
+         size *= 2) {
+        char name[32];
+        snprintf(name, sizeof(name), "bench%u", size / 1024);
+        std::string path = std::string(name) + ".dat";
+        RelationInfo relation;
+        relation.path = path;
+        FieldInfo field;
+        field.name = "id";
+        field.index = 0;
+        field.length = 8;
+        field.fieldType = "BIGINT";
+        relation.fields.push_back(field);
+        field.name = "name";
+        field.index = 1;
+        field.length = -255;
+        field.fieldType = "VARCHAR";
+        relation.fields.push_back(field);
+        relation.count = 2;
+        relation.key = 0;
+
+        Table table;
+        REQUIRE(table.create(name, relation) == S_OK);
+        REQUIRE(table.open(name) == S_OK);
+        REQUIRE(table.setBlockSize(size) == S_OK);
+        REQUIRE(table.initial() == S_OK);
+
+        // 按与rows互素的步长打乱插入顺序
+        std::string value(100, 'v');
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (long long i = 0; i < rows; ++i) {
+            long long id = (i * 7919) % rows + 1;
+            struct iovec iov[2];
+            iov[0].iov_base = &id;
+            iov[0].iov_len = sizeof(long long);
+            iov[1].iov_base = (void *) value.c_str();
+            iov[1].iov_len = value.size() + 1;
+            unsigned char header = 0;
+            REQUIRE(table.insert(&header, iov, 2) == S_OK);
+        }
+        double insert = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+        start = std::chrono::steady_clock::now();
+        long long count = 0;
+        for (auto it1 = table.blockBegin(PIN_ONCE); it1 != table.blockEnd();
+             ++it1)
+            for (auto it2 = table.begin(it1); it2 != table.end(it1); ++it2)
+                ++count;
+        double scan = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+        REQUIRE(count == rows);
+
+        start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < rows; ++i) {
+            long long key = (i * 104729) % rows + 1;
+            iovec keyField = {&key, sizeof(key)};
+            long long id;
+            char name[128];
+            struct iovec iov[2] = {{&id, sizeof(id)}, {name, sizeof(name)}};
+            unsigned char header;
+            REQUIRE(table.get(keyField, &header, iov, 2) == S_OK);
+        }
+        double get = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+        printf(
+            "block=%2uKB insert %.0f rows/s, scan %.0f rows/s, get %.0f rows/s\n",
+            size / 1024,
+            rows / insert,
+            rows / scan,
+            rows / get);
+        table.close(path.c_str());
+        table.destroy(path.c_str());
+    }
+    REQUIRE(gschema.destroy() == S_OK);
+}